@@ -2,15 +2,31 @@
 #include <string.h>
 #include <iostream>
 #include <vector>
-#include <sstream>
 #include <sys/wait.h>
 #include <iomanip>
 #include "Commands.h"
+#include "signals.h"
+#include "trace.h"
 
 #include <cstring>     // For strcpy
 #include <fcntl.h>     // For open and its flags  // for `open` and its MACROs
 #include <sys/types.h> // For data types          // for `open` and its MACROs
 #include <sys/stat.h>  // For mode constants      // for `open` and its MACROs
+#include <sys/mman.h>  // for `mmap` and `memfd_create`
+#include <spawn.h>     // for `posix_spawn`
+#include <errno.h>
+#include <glob.h>      // for `glob`
+#include <signal.h>
+#include <cctype>      // for `isdigit` and `isspace`
+#include <algorithm>   // for `std::min` and the heap functions
+#include <functional>  // for `std::greater`
+#include <sys/sendfile.h> // for `sendfile`
+#include <sys/syscall.h>  // for `SYS_pidfd_open`
+#include <poll.h>         // for `ppoll`
+#include <sys/epoll.h>    // for `epoll_create1`
+#include <sys/resource.h> // for `wait4` and `getrusage`
+#include <limits.h>       // for `PIPE_BUF`
+#include <dirent.h>       // for `opendir`
 
 #define COMMAND_MAX_PATH_LENGTH (80)
 #define COMMAND_MAX_LENGTH (80)
@@ -19,6 +35,11 @@ using namespace std;
 
 const std::string WHITESPACE = " \n\r\t\f\v";
 
+extern char **environ; // passed as is to the spawned commands
+
+// characters with a meaning to bash that smash doesn't parse by itself (quoting, variables, ...)
+const char *SHELL_SYNTAX = "'\"\\$`;(){}<>|&";
+
 #if 0
 #define FUNC_ENTRY() \
   cout << __PRETTY_FUNCTION__ << " --> " << endl;
@@ -44,24 +65,18 @@ string _rtrim(const std::string &s)
 
 string _trim(const std::string &s)
 {
-  return _rtrim(_ltrim(s));
-}
-
-int _parseCommandLine(const char *cmd_line, char **args)
-{
-  FUNC_ENTRY()
-  int i = 0;
-  std::istringstream iss(_trim(string(cmd_line)).c_str());
-  for (std::string s; iss >> s;)
+  // a single copy (instead of _rtrim(_ltrim(s)))
+  size_t start = s.find_first_not_of(WHITESPACE);
+  if (start == std::string::npos)
   {
-    args[i] = (char *)malloc(s.length() + 1);
-    memset(args[i], 0, s.length() + 1);
-    strcpy(args[i], s.c_str());
-    args[++i] = NULL;
+    return "";
   }
-  return i;
+  return s.substr(start, s.find_last_not_of(WHITESPACE) - start + 1);
+}
 
-  FUNC_EXIT()
+bool _isWhitespace(char c)
+{
+  return c != '\0' && strchr(" \n\r\t\f\v", c) != nullptr;
 }
 
 bool _isBackgroundCommand(const char *cmd_line)
@@ -94,1113 +109,4313 @@ void _removeBackgroundSign(char *cmd_line)
 // TODO: Add your implementation for classes in Commands.h
 
 /* *
- * Command
+ * CommandTokens
  */
 
-Command::Command(const char *cmd_line)
-    : m_ground_type((_isBackgroundCommand(cmd_line)) ? (GroundType::Background) : (GroundType::Foreground)),
-      m_cmd_line(cmd_line), // (m_ground_type == GroundType::Background) ? _trim(m_remove_background_sign(cmd_line)) : _trim(cmd_line)
-      m_valid(true)
-{
-}
-
-Command::~Command()
-{
-  // default
-}
-
-std::string Command::m_remove_background_sign(const char *cmd_line) const
+CommandTokens::CommandTokens(const char *cmd_line)
+    : m_count(0)
 {
-  // ? should we check for std::bad_alloc?
-  // copy the cmd_line
-  char *cmd_line_copy = new char[strlen(cmd_line) + 1];
-  strcpy(cmd_line_copy, cmd_line);
-
-  // remove the background sign from the copy
-  _removeBackgroundSign(cmd_line_copy);
+  size_t line_length = strlen(cmd_line);
+  if (line_length > COMMAND_ARGS_MAX_LENGTH) // doesn't fit in the fixed arena
+  {
+    m_long_arena.resize(line_length + 1);
+  }
+  char *words = arena();
 
-  std::string modified_cmd_line(cmd_line_copy);
+  // ignore the tailing spaces and the background sign
+  size_t end = line_length;
+  while (end > 0 && _isWhitespace(cmd_line[end - 1]))
+  {
+    --end;
+  }
+  if (end > 0 && cmd_line[end - 1] == '&')
+  {
+    --end;
+  }
 
-  // dont forget to delete the allocated memory
-  delete[] cmd_line_copy;
+  // copy each word into the arena followed by a '\0', the arena never needs more than (end + 1) chars
+  unsigned int written = 0;
+  size_t i = 0;
+  while (true)
+  {
+    while (i < end && _isWhitespace(cmd_line[i]))
+    {
+      ++i;
+    }
+    if (i >= end)
+    {
+      break;
+    }
+    Span word;
+    word.offset = written;
+    while (i < end && !_isWhitespace(cmd_line[i]))
+    {
+      words[written++] = cmd_line[i++];
+    }
+    word.length = written - word.offset;
+    words[written++] = '\0';
 
-  // Return the modified command line
-  return modified_cmd_line;
+    if (m_count <= COMMAND_MAX_ARGS)
+    {
+      m_spans[m_count] = word;
+    }
+    else
+    {
+      m_more_spans.push_back(word);
+    }
+    ++m_count;
+  }
 }
 
-/*
- * External Commands
- */
-
-ExternalCommand::Complexity ExternalCommand::_get_complexity_type(const char *cmd_line)
+char **CommandTokens::argv()
 {
-  if (std::string(cmd_line).find_first_of("*?") != std::string::npos)
+  char **argv = m_argv;
+  if (m_count > COMMAND_MAX_ARGS + 1)
   {
-    return Complexity::Complex;
+    m_long_argv.resize(m_count + 1);
+    argv = &m_long_argv[0];
   }
-  else
+  for (unsigned int i = 0; i < m_count; ++i)
   {
-    return Complexity::Simple;
+    argv[i] = arena() + span(i).offset;
   }
+  argv[m_count] = nullptr;
+  return argv;
 }
 
-ExternalCommand::ExternalCommand(const char *cmd_line)
-    : Command(cmd_line),
-      m_complexity(_get_complexity_type(cmd_line))
+/**
+ * A file descriptor that refers to the process itself (and not to its pid, which may be reused),
+ * or -1 if the kernel doesn't support it.
+ * Only valid for a child that was not reaped yet, or it may refer to another process that got the pid.
+ */
+int _open_pidfd(pid_t pid)
 {
-  // cant really do any checks for if a command is external or not
+#ifdef SYS_pidfd_open
+  return syscall(SYS_pidfd_open, pid, 0);
+#else
+  (void)pid;
+  errno = ENOSYS;
+  return -1;
+#endif
 }
 
-ExternalCommand::~ExternalCommand()
+// like kill(2), through a pidfd (see _open_pidfd)
+int _pidfd_send_signal(int pidfd, int signal)
 {
-  // default
+#ifdef SYS_pidfd_send_signal
+  return syscall(SYS_pidfd_send_signal, pidfd, signal, nullptr, 0);
+#else
+  (void)pidfd;
+  (void)signal;
+  errno = ENOSYS;
+  return -1;
+#endif
 }
 
-void ExternalCommand::execute()
+void _perror(const char *message)
 {
+  int saved_errno = errno; // the flush may change it
+  std::cout.flush();
+  errno = saved_errno;
+  perror(message);
+}
 
-  pid_t pid = fork();
+// in seconds, for durations (not affected by changes of the wall clock)
+double _monotonic_seconds()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
 
-  if (pid == 0) // * son
+// the contents of /proc/<pid>/<name> (NUL terminated), false if the process is gone
+bool _read_proc_file(pid_t pid, const char *name, char *buffer, size_t size)
+{
+  std::string path = "/proc/" + std::to_string(pid) + "/" + name;
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
   {
-    if (setpgrp() == -1) // failure
-    {
-      perror("smash error: setpgrp failed");
-      return;
-    }
-
-    if (m_complexity == Complexity::Complex)
-    {
-      // trim the cmd_line and remove back ground sign (also then trim)
-      const char *command_line = _trim(Command::m_remove_background_sign(getCMDLine().c_str())).c_str();
-
-      if (execlp("/bin/bash", "/bin/bash", "-c", command_line, nullptr) != 0) // failure
-      {
-        perror("smash error: execlp failed");
-      }
-    }
-    else
-    {
-      char *args[COMMAND_MAX_ARGS + 1] = {0};
-      char trimmed_cmd_line[COMMAND_MAX_LENGTH + 1];
-
-      strcpy(trimmed_cmd_line, getCMDLine().c_str());
-
-      _removeBackgroundSign(trimmed_cmd_line);
-
-      _parseCommandLine(_trim(std::string(trimmed_cmd_line)).c_str(), args);
-
-      if (execvp(args[0], args) == -1)
-      {
-        perror("smash error: setpgrp failed");
-        return;
-      }
-    }
+    return false;
   }
-  else // * parent
+  ssize_t bytes;
+  while ((bytes = read(fd, buffer, size - 1)) == -1 && errno == EINTR)
   {
-    if (isBackground())
-    {
-      SmallShell::getInstance().getJobsList().addJob(this, pid);
-    }
-    else
-    {
-      if (waitpid(pid, nullptr, WUNTRACED) == -1)
-      {
-        perror("smash error: waitpid failed");
-      }
-    }
   }
+  close(fd);
+  if (bytes <= 0)
+  {
+    return false;
+  }
+  buffer[bytes] = '\0';
+  return true;
 }
 
-/*
- * Special Commands
+/* *
+ * RedirectionPlan
  */
 
-// * Special Commands 1 (RedirectionCommand)
+RedirectionPlan::RedirectionPlan()
+    : m_operations()
+{
+}
 
-bool _is_redirection_command(const char *cmd_line)
+bool RedirectionPlan::parse(const std::string &cmd_line, std::string *command, std::string *error)
 {
-  if (cmd_line)
+  enum STANDARD
   {
-    std::string s(cmd_line);
-    // if no > were found, return false
-    int index_first = s.find_first_of(">");
-    int index_second = s.find_last_of(">");
-    if (index_first == std::string::npos)
+    IN = 0,
+    OUT = 1,
+    ERR = 2
+  };
+
+  m_operations.clear();
+  command->clear();
+  char quote = '\0'; // the operators inside quotes are just text
+  size_t i = 0;
+  while (i < cmd_line.size())
+  {
+    char c = cmd_line[i];
+    if (quote != '\0' || c == '\'' || c == '"')
     {
-      return false;
+      quote = (quote == '\0') ? c : ((c == quote) ? '\0' : quote);
+      command->push_back(c);
+      ++i;
+      continue;
     }
-    else
+
+    // the operator may start with the redirected descriptor ("2>") or with "&" (both stdout and stderr)
+    size_t op = i;
+    int fd = -1;
+    bool both = false;
+    if (isdigit(c) && i + 1 < cmd_line.size() && (i == 0 || isspace(cmd_line[i - 1])))
     {
-      if (index_second - index_first > 1)
-      {
-        return false; // there are more than two ">>"
-      }
-      return true;
+      fd = c - '0';
+      op = i + 1;
+    }
+    else if (c == '&' && i + 1 < cmd_line.size() && cmd_line[i + 1] == '>')
+    {
+      both = true;
+      op = i + 1;
+    }
+    if (cmd_line[op] != '<' && cmd_line[op] != '>')
+    {
+      command->push_back(c);
+      ++i;
+      continue;
     }
-  }
-  return false;
-}
 
-RedirectionCommand::RedirectionType RedirectionCommand::get_redirection_type(const char *cmd_line)
-{
-  // assumes there is atleast ">" or ">>"
-  std::string s(cmd_line);
-  int first_symbol_index = s.find_first_of(">");
-  if (first_symbol_index == std::string::npos)
-  {
-    throw logic_error("something went wrong in RedirectionCommand::get_redirection_type\n");
-    // or invalidate_command();
-  }
-  else
-  {
-    // if this index is the last character (something is wrong)
-    if (first_symbol_index >= s.size() - 1)
+    std::string target;
+    if (cmd_line.compare(op, 3, "<<<") == 0)
     {
-      throw logic_error("something went wrong in RedirectionCommand::get_redirection_type\n");
-      // or invalidate_command();
+      i = _read_word(cmd_line, op + 3, &target);
+      addText((fd == -1) ? STANDARD::IN : fd, target);
+    }
+    else if (cmd_line[op] == '<')
+    {
+      i = _read_word(cmd_line, op + 1, &target);
+      addFile((fd == -1) ? STANDARD::IN : fd, target, O_RDONLY);
     }
     else
     {
-      if (s[first_symbol_index + 1] == '>')
+      bool append = (cmd_line.compare(op, 2, ">>") == 0);
+      size_t after = op + (append ? 2 : 1);
+      if (!append && !both && after < cmd_line.size() && cmd_line[after] == '&') // [n]>&m
       {
-        return RedirectionType::Append;
+        i = _read_word(cmd_line, after + 1, &target);
+        if (target.size() != 1 || !isdigit(target[0]))
+        {
+          *error = "bad file descriptor in redirection";
+          return false;
+        }
+        addDuplicate((fd == -1) ? STANDARD::OUT : fd, target[0] - '0');
       }
       else
       {
-        return RedirectionType::Override;
+        i = _read_word(cmd_line, after, &target);
+        // O_WRONLY: Open for writing only.
+        // O_CREAT: Create file if it does not exist.
+        // O_TRUNC / O_APPEND: Truncate size to 0 / Append data at the end of the file.
+        int flags = O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC);
+        addFile(both ? STANDARD::OUT : ((fd == -1) ? STANDARD::OUT : fd), target, flags);
+        if (both)
+        {
+          addDuplicate(STANDARD::ERR, STANDARD::OUT);
+        }
       }
     }
+    if (target.empty())
+    {
+      *error = "missing redirection target";
+      return false;
+    }
+    command->push_back(' ');
+  }
+
+  *command = _trim(*command);
+  if (command->empty())
+  {
+    *error = "missing command before redirection";
+    return false;
   }
+  return true;
 }
 
-RedirectionCommand::RedirectionCommand(const char *cmd_line)
-    : Command(cmd_line),
-      m_command(nullptr),
-      m_file_path()
+size_t RedirectionPlan::_read_word(const std::string &cmd_line, size_t start, std::string *word)
 {
-  if (!_is_redirection_command(cmd_line))
+  size_t i = start;
+  while (i < cmd_line.size() && isspace(cmd_line[i]))
   {
-    throw std::logic_error("shouldn't get here in RedirectionCommand::RedirectionCommand.");
+    ++i;
   }
-  RedirectionType m_redirection_type = get_redirection_type(cmd_line);
-
-  if (is_valid())
+  if (i < cmd_line.size() && (cmd_line[i] == '\'' || cmd_line[i] == '"')) // quoted, without the quotes
   {
-    std::string cmd_str(cmd_line);
-    std::string command_str = _trim(cmd_str.substr(0, cmd_str.find_first_of(">")));
-    Command *m_command = SmallShell::getInstance().CreateCommand(command_str.c_str());
-    if (m_command == nullptr)
-    {
-      invalidate_command();
-      return;
-    }
-    m_file_path = _trim(cmd_str.substr(cmd_str.find_last_of(">") + 1));
+    size_t end = cmd_line.find(cmd_line[i], i + 1);
+    end = (end == std::string::npos) ? cmd_line.size() : end;
+    *word = cmd_line.substr(i + 1, end - (i + 1));
+    return std::min(end + 1, cmd_line.size());
   }
+  size_t end = i;
+  while (end < cmd_line.size() && !isspace(cmd_line[end]) && cmd_line[end] != '<' && cmd_line[end] != '>')
+  {
+    ++end;
+  }
+  *word = cmd_line.substr(i, end - i);
+  return end;
 }
 
-RedirectionCommand::~RedirectionCommand()
+void RedirectionPlan::addFile(int fd, const std::string &path, int flags)
 {
-  // default
+  Operation operation = {Kind::File, fd, path, flags, -1};
+  m_operations.push_back(operation);
 }
 
-void RedirectionCommand::execute()
+void RedirectionPlan::addDuplicate(int fd, int source)
 {
-  // this command will not be tested with &
-  enum STANDARD
-  {
-    IN = 0,
-    OUT = 1,
-  };
+  Operation operation = {Kind::Duplicate, fd, std::string(), 0, source};
+  m_operations.push_back(operation);
+}
 
-  int original_stdout = dup(STANDARD::OUT); // ? should we use STDOUT_FILENO
+void RedirectionPlan::addText(int fd, const std::string &text)
+{
+  Operation operation = {Kind::Text, fd, text, 0, -1};
+  m_operations.push_back(operation);
+}
 
-  if (original_stdout == -1)
+bool RedirectionPlan::open()
+{
+  TRACE_SCOPE("redirection setup");
+  for (Operation &operation : m_operations)
   {
-    perror("smash error: dup failed");
-    return;
-    // exit(EXIT_FAILURE);
+    if (operation.kind == Kind::File)
+    {
+      // 0644: File permission bits (user: read+write, group: read, others: read).
+      operation.source = ::open(operation.text.c_str(), operation.flags | O_CLOEXEC, 0644);
+      if (operation.source == -1)
+      {
+        _perror("smash error: open failed");
+        close();
+        return false;
+      }
+    }
+    else if (operation.kind == Kind::Text)
+    {
+      // an anonymous file and not a pipe, so a text of any size can be written before the command reads it
+      operation.source = memfd_create("smash-here-string", MFD_CLOEXEC);
+      std::string content = operation.text + "\n";
+      if (operation.source == -1 ||
+          write(operation.source, content.data(), content.size()) != static_cast<ssize_t>(content.size()) ||
+          lseek(operation.source, 0, SEEK_SET) == -1)
+      {
+        _perror("smash error: here-string failed");
+        close();
+        return false;
+      }
+    }
   }
+  return true;
+}
 
-  // close the original fd for standard output
-  if (close(STANDARD::OUT))
+void RedirectionPlan::close()
+{
+  TRACE_SCOPE("redirection teardown");
+  for (Operation &operation : m_operations)
   {
-    perror("smash error: close failed");
+    if (operation.kind == Kind::Duplicate) // not ours
+    {
+      continue;
+    }
+    if (operation.source != -1 && ::close(operation.source) == -1)
+    {
+      _perror("smash error: close failed");
+    }
+    operation.source = -1;
   }
+}
 
-  if (m_redirection_type == RedirectionType::Override)
+bool RedirectionPlan::apply() const
+{
+  for (const Operation &operation : m_operations)
   {
-    // open a new/existing file for overriding (its fd will be 1)
-    // O_WRONLY: Open for writing only.
-    // O_CREAT: Create file if it does not exist.
-    // O_TRUNC: Truncate size to 0.
-    // 0644: File permission bits (user: read+write, group: read, others: read).
-    if (open(m_file_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644) == -1)
+    if (operation.source == operation.fd && operation.kind != Kind::Duplicate)
     {
-      perror("smash error: open failed");
-      return;
+      // opened right onto its target (the smash was started without it), dup2 would keep the close-on-exec flag
+      if (fcntl(operation.fd, F_SETFD, 0) == -1)
+      {
+        _perror("smash error: fcntl failed");
+        return false;
+      }
     }
-  }
-  else // (m_redirection_type == RedirectionType::Append)
-  {
-    // open a new/existing file for appending (its fd will be 1)
-    // O_WRONLY: Open for writing only.
-    // O_CREAT: Create file if it does not exist.
-    // O_APPEND: Append data at the end of the file.
-    // 0644: File permission bits (user: read+write, group: read, others: read).
-    if (open(m_file_path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644) == -1)
+    else if (dup2(operation.source, operation.fd) == -1)
     {
-      perror("smash error: open failed");
-      return;
+      _perror("smash error: dup2 failed");
+      return false;
     }
   }
+  return true;
+}
 
-  // execute command
-  m_command->execute();
-
-  // Restore the original stdout
-  if (dup2(original_stdout, STANDARD::OUT) == -1)
+bool RedirectionPlan::spawnable() const
+{
+  for (const Operation &operation : m_operations)
   {
-    perror("smash  error: dup2 failed");
-    exit(EXIT_FAILURE);
+    if (operation.source == operation.fd && operation.kind != Kind::Duplicate)
+    {
+      return false;
+    }
   }
-
-  // program returned to the original state where stdout in the standard output stream.
+  return true;
 }
 
-// * Special Commands 2 (PipeCommand)
-
-bool _is_pipe_command(const char *cmd_line)
+void RedirectionPlan::addTo(posix_spawn_file_actions_t *actions) const
 {
-  if (std::string(cmd_line).find_first_of("|") != std::string::npos)
+  for (const Operation &operation : m_operations)
   {
-    return true;
+    // the dup2 clears the close-on-exec flag of the new descriptor only, the source is closed on the exec
+    posix_spawn_file_actions_adddup2(actions, operation.source, operation.fd);
   }
-  return false;
 }
 
-PipeCommand::PipeType PipeCommand::_get_pipe_type(const char *cmd_line)
-{
-  std::string s(cmd_line);
-  int index_of_line = s.find_first_of("|");
-  int index_of_amp = s.find_first_of("&");
+/* *
+ * ScopedRedirection
+ */
 
-  if (index_of_line != std::string::npos)
+ScopedRedirection::ScopedRedirection(const RedirectionPlan &plan)
+    : m_saved(),
+      m_applied(false)
+{
+  TRACE_SCOPE("redirection setup");
+  // the buffered output belongs to the original descriptors
+  std::cout.flush();
+  for (const RedirectionPlan::Operation &operation : plan.getOperations())
   {
-    if (index_of_amp != std::string::npos)
+    // kept above the standard descriptors, and not inherited by the commands
+    Saved saved = {operation.fd, fcntl(operation.fd, F_DUPFD_CLOEXEC, 10)};
+    if (saved.copy == -1 && errno != EBADF) // EBADF: it was not open to begin with
     {
-      return PipeType::Standard;
+      _perror("smash error: fcntl failed");
+      return; // the destructor restores what was already redirected
     }
-    else
+    m_saved.push_back(saved);
+    if (dup2(operation.source, operation.fd) == -1)
     {
-      return PipeType::Error;
+      _perror("smash error: dup2 failed");
+      return;
     }
   }
-  else
-  {
-    throw std::logic_error("PipeCommand::_get_pipe_type");
-  }
+  m_applied = true;
 }
 
-Command *PipeCommand::_get_cmd_1(const char *cmd_line)
+ScopedRedirection::~ScopedRedirection()
 {
-  std::string s(cmd_line);
-  int index_of_line = s.find_first_of("|");
-  if (index_of_line != std::string::npos)
+  TRACE_SCOPE("redirection teardown");
+  // the output of the command goes to the file before the original descriptors are back
+  std::cout.flush();
+  for (std::vector<Saved>::reverse_iterator it = m_saved.rbegin(); it != m_saved.rend(); ++it)
   {
-    Command *command = SmallShell::getInstance().CreateCommand(s.substr(0, index_of_line).c_str());
-    if (command)
+    if (it->copy == -1)
     {
-      return command;
+      close(it->fd);
+      continue;
     }
-    else
+    if (dup2(it->copy, it->fd) == -1)
     {
-      throw std::logic_error("PipeCommand::_get_cmd_1");
+      _perror("smash error: dup2 failed");
     }
+    close(it->copy);
   }
-  return nullptr;
 }
 
-Command *PipeCommand::_get_cmd_2(const char *cmd_line)
-{
+/* *
+ * CommandPool
+ */
 
-  std::string s(cmd_line);
-  int index_of_line = s.find_first_of("|");
-  int index_of_amp = s.find_first_of("&");
+CommandPool::FreeBlock *CommandPool::FREE_LISTS[CommandPool::SIZE_CLASSES] = {};
 
-  if (index_of_line != std::string::npos)
+void *CommandPool::allocate(size_t size)
+{
+  size_t size_class = (size + GRANULARITY - 1) / GRANULARITY;
+  if (size_class >= SIZE_CLASSES)
   {
-    Command *command;
-    if (index_of_amp != std::string::npos)
-    {
-      command = SmallShell::getInstance().CreateCommand(s.substr(index_of_amp + 1).c_str());
-    }
-    else
-    {
-      command = SmallShell::getInstance().CreateCommand(s.substr(index_of_line + 1).c_str());
-    }
-
-    if (command)
-    {
-      return command;
-    }
-    else
-    {
-      throw std::logic_error("PipeCommand::_get_cmd_2");
-    }
+    return ::operator new(size);
   }
-  return nullptr;
+  FreeBlock *block = FREE_LISTS[size_class];
+  if (block == nullptr) // nothing to reuse yet, the block gets the full size of its class
+  {
+    return ::operator new(size_class * GRANULARITY);
+  }
+  FREE_LISTS[size_class] = block->next;
+  return block;
 }
 
-PipeCommand::PipeCommand(const char *cmd_line)
-    : Command(cmd_line)
+void CommandPool::deallocate(void *block, size_t size)
 {
-  if (_is_pipe_command(cmd_line))
+  if (block == nullptr)
   {
-    m_pipe_type = _get_pipe_type(cmd_line);
-    m_cmd_1 = _get_cmd_1(cmd_line);
-    m_cmd_2 = _get_cmd_2(cmd_line);
-    if (m_cmd_1 == nullptr || m_cmd_2 == nullptr) // no need but will keep for more safety
-    {
-      throw std::logic_error("PipeCommand::PipeCommand");
-    }
+    return;
   }
-  else
+  size_t size_class = (size + GRANULARITY - 1) / GRANULARITY;
+  if (size_class >= SIZE_CLASSES)
   {
-    throw std::logic_error("PipeCommand::PipeCommand");
+    ::operator delete(block);
+    return;
   }
+  FreeBlock *free_block = static_cast<FreeBlock *>(block);
+  free_block->next = FREE_LISTS[size_class];
+  FREE_LISTS[size_class] = free_block;
 }
 
-PipeCommand::~PipeCommand()
+/* *
+ * Command
+ */
+
+Command::Command(const char *cmd_line)
+    : m_ground_type((_isBackgroundCommand(cmd_line)) ? (GroundType::Background) : (GroundType::Foreground)),
+      m_cmd_line(cmd_line), // (m_ground_type == GroundType::Background) ? _trim(m_remove_background_sign(cmd_line)) : _trim(cmd_line)
+      m_valid(true),
+      m_timeout(0),
+      m_timeout_cmd_line(),
+      m_job_cmd_line(),
+      m_job(false),
+      m_start_time(0)
+{
+}
+
+Command::~Command()
 {
   // default
 }
 
-void PipeCommand::execute()
+void Command::markStarted()
 {
-  // this command will not be tested with &
-  enum PIPE
+  if (m_start_time == 0)
   {
-    READ = 0,
+    m_start_time = _monotonic_seconds();
+  }
+}
+
+void Command::release(Command *command)
+{
+  if (command && !command->isJob())
+  {
+    delete command;
+  }
+}
+
+bool Command::setTimeout(unsigned int seconds, const std::string &cmd_line)
+{
+  m_timeout = seconds;
+  m_timeout_cmd_line = cmd_line;
+  return true;
+}
+
+void Command::_schedule_timeout(pid_t pid, bool group) const
+{
+  if (m_timeout_cmd_line.empty()) // not timed
+  {
+    return;
+  }
+  SmallShell::getInstance().getTimeouts().add(pid, m_timeout, m_timeout_cmd_line, group);
+}
+
+void Command::executeInChild()
+{
+  execute();
+  std::cout.flush();
+  _exit(0); // the destructors of the smash singletons belong to the parent
+}
+
+std::string Command::m_remove_background_sign(const char *cmd_line) const
+{
+  // ? should we check for std::bad_alloc?
+  // copy the cmd_line
+  char *cmd_line_copy = new char[strlen(cmd_line) + 1];
+  strcpy(cmd_line_copy, cmd_line);
+
+  // remove the background sign from the copy
+  _removeBackgroundSign(cmd_line_copy);
+
+  std::string modified_cmd_line(cmd_line_copy);
+
+  // dont forget to delete the allocated memory
+  delete[] cmd_line_copy;
+
+  // Return the modified command line
+  return modified_cmd_line;
+}
+
+/*
+ * External Commands
+ */
+
+ExternalCommand::Complexity ExternalCommand::_get_complexity_type(const CommandTokens &tokens)
+{
+  bool wildcards = false;
+  bool shell_syntax = false;
+  for (unsigned int i = 0; i < tokens.size(); ++i)
+  {
+    wildcards = wildcards || strpbrk(tokens[i], "*?");
+    shell_syntax = shell_syntax || strpbrk(tokens[i], SHELL_SYNTAX);
+  }
+
+  if (!wildcards)
+  {
+    return Complexity::Simple;
+  }
+  // smash expands the wildcards by itself, only lines it can't parse are handed to bash
+  return shell_syntax ? Complexity::Complex : Complexity::Glob;
+}
+
+ExternalCommand::ExternalCommand(const char *cmd_line, const CommandTokens &tokens)
+    : Command(cmd_line),
+      m_complexity(_get_complexity_type(tokens)),
+      m_tokens(tokens)
+{
+  // cant really do any checks for if a command is external or not
+}
+
+ExternalCommand::~ExternalCommand()
+{
+  // default
+}
+
+/* static variables */
+ExternalCommand::LaunchEngine ExternalCommand::LAUNCH_ENGINE = ExternalCommand::LaunchEngine::Auto;
+
+void ExternalCommand::execute()
+{
+  // whatever was printed so far comes before the output of the command
+  std::cout.flush();
+  pid_t pid = (_launch_engine() == LaunchEngine::Spawn) ? _spawn() : _fork_and_exec();
+  if (pid == -1) // failure, already reported
+  {
+    return;
+  }
+  _schedule_timeout(pid);
+
+  if (isBackground())
+  {
+    SmallShell::getInstance().getJobsList().addJob(this, pid);
+  }
+  else
+  {
+    SmallShell::getInstance().waitForeground(this, pid);
+  }
+}
+
+void ExternalCommand::executeInChild()
+{
+  // already in a child, no need for another one
+  _exec(-1);
+}
+
+bool ExternalCommand::acceptRedirections(const RedirectionPlan &plan)
+{
+  m_redirections = plan;
+  return true;
+}
+
+pid_t ExternalCommand::_spawn()
+{
+  // posix_spawn returns once the child has called exec, so the exec is part of it
+  TRACE_SCOPE("spawn");
+  posix_spawnattr_t attributes;
+  posix_spawnattr_init(&attributes);
+  // replaces the setpgrp() the child would have called after fork
+  posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETPGROUP);
+  posix_spawnattr_setpgroup(&attributes, 0);
+  // the redirections are only applied in the child, the smash keeps its own descriptors
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  m_redirections.addTo(&actions);
+
+  pid_t pid = -1;
+  int error;
+  if (m_complexity == Complexity::Complex)
+  {
+    std::string command_line = _trim(Command::m_remove_background_sign(getCMDLine().c_str()));
+    char *const args[] = {const_cast<char *>("/bin/bash"), const_cast<char *>("-c"), &command_line[0], nullptr};
+    error = posix_spawn(&pid, args[0], &actions, &attributes, args, environ);
+  }
+  else if (m_complexity == Complexity::Glob)
+  {
+    glob_t expanded;
+    if (!_expand_wildcards(&expanded))
+    {
+      posix_spawn_file_actions_destroy(&actions);
+      posix_spawnattr_destroy(&attributes);
+      return -1;
+    }
+    error = _spawn_resolved(&pid, &actions, &attributes, expanded.gl_pathv);
+    globfree(&expanded);
+  }
+  else
+  {
+    error = _spawn_resolved(&pid, &actions, &attributes, m_tokens.argv());
+  }
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attributes);
+
+  if (error != 0) // posix_spawn returns the error instead of setting errno
+  {
+    errno = error;
+    _perror("smash error: execvp failed");
+    return -1;
+  }
+  return pid;
+}
+
+pid_t ExternalCommand::_fork_and_exec()
+{
+  // the child forgets a cached executable that is gone in its own copy of the path cache only,
+  // so it sends the name back through this pipe (closed by its exec)
+  int stale[2];
+  if (pipe2(stale, O_CLOEXEC) == -1)
+  {
+    _perror("smash error: pipe failed");
+    return -1;
+  }
+
+  TraceScope fork_scope("fork");
+  pid_t pid = fork();
+  fork_scope.end();
+  if (pid == -1)
+  {
+    _perror("smash error: fork failed");
+  }
+  else if (pid == 0) // * son
+  {
+    close(stale[0]);
+    if (setpgrp() == -1) // failure
+    {
+      _perror("smash error: setpgrp failed");
+      _exit(EXIT_FAILURE);
+    }
+    if (!m_redirections.apply())
+    {
+      _exit(EXIT_FAILURE);
+    }
+    _exec(stale[1]);
+  }
+  close(stale[1]);
+
+  if (pid != -1)
+  {
+    // returns once the child called exec (or exited), just like posix_spawn
+    char name[PIPE_BUF];
+    ssize_t length;
+    while ((length = read(stale[0], name, sizeof(name) - 1)) == -1 && errno == EINTR)
+    {
+    }
+    if (length > 0)
+    {
+      name[length] = '\0';
+      SmallShell::getInstance().getPathCache().forget(name);
+    }
+  }
+  close(stale[0]);
+  return pid;
+}
+
+void ExternalCommand::_exec(int stale_fd)
+{
+  if (m_complexity == Complexity::Complex)
+  {
+    // trim the cmd_line and remove back ground sign (also then trim)
+    std::string command_line = _trim(Command::m_remove_background_sign(getCMDLine().c_str()));
+
+    execlp("/bin/bash", "/bin/bash", "-c", command_line.c_str(), nullptr);
+    _perror("smash error: execlp failed"); // exec only returns on failure
+  }
+  else if (m_complexity == Complexity::Glob)
+  {
+    glob_t expanded; // no need to free it, the process is replaced or exits
+    if (_expand_wildcards(&expanded))
+    {
+      _exec_resolved(expanded.gl_pathv, stale_fd);
+      _perror("smash error: execvp failed"); // exec only returns on failure
+    }
+  }
+  else
+  {
+    // the tokens are already NUL-terminated words, the background sign excluded
+    _exec_resolved(m_tokens.argv(), stale_fd);
+    _perror("smash error: execvp failed"); // exec only returns on failure
+  }
+  _exit(EXIT_FAILURE);
+}
+
+ExternalCommand::LaunchEngine ExternalCommand::_launch_engine() const
+{
+  if (LAUNCH_ENGINE != LaunchEngine::Auto)
+  {
+    return LAUNCH_ENGINE;
+  }
+  // posix_spawn unless the child has some work of its own to do before the exec
+  return m_redirections.spawnable() ? LaunchEngine::Spawn : LaunchEngine::Fork;
+}
+
+int ExternalCommand::_spawn_resolved(pid_t *pid, const posix_spawn_file_actions_t *actions,
+                                     const posix_spawnattr_t *attributes, char **args)
+{
+  CommandPathCache &path_cache = SmallShell::getInstance().getPathCache();
+  std::string path;
+  int error = ENOENT;
+  if (path_cache.resolve(args[0], &path))
+  {
+    error = posix_spawn(pid, path.c_str(), actions, attributes, args, environ);
+    if (error == ENOENT) // the cached executable is gone, posix_spawnp searches the PATH again
+    {
+      path_cache.forget(args[0]);
+    }
+  }
+  // the paths (and the names that are not in the PATH) are tried only once, by posix_spawnp, which reports the errors
+  // just like execvp (and runs scripts without a #! line through sh)
+  if (error == ENOENT || error == ENOEXEC)
+  {
+    error = posix_spawnp(pid, args[0], actions, attributes, args, environ);
+  }
+  return error;
+}
+
+void ExternalCommand::_exec_resolved(char **args, int stale_fd)
+{
+  std::string path;
+  if (SmallShell::getInstance().getPathCache().resolve(args[0], &path))
+  {
+    execv(path.c_str(), args);
+    if (errno == ENOENT && stale_fd != -1) // the cached executable is gone, for the smash to forget
+    {
+      ssize_t written = write(stale_fd, args[0], strnlen(args[0], PIPE_BUF - 1));
+      (void)written;
+    }
+  }
+  execvp(args[0], args);
+}
+
+bool ExternalCommand::_expand_wildcards(glob_t *expanded)
+{
+  // like bash: a word without wildcards, or that matches nothing, is passed as is
+  int flags = GLOB_NOCHECK | GLOB_NOMAGIC;
+  for (unsigned int i = 0; i < m_tokens.size(); ++i)
+  {
+    if (glob(m_tokens[i], flags, nullptr, expanded) != 0) // can only be out of memory, with GLOB_NOCHECK
+    {
+      std::cerr << "smash error: glob failed\n";
+      if (flags & GLOB_APPEND)
+      {
+        globfree(expanded);
+      }
+      return false;
+    }
+    flags |= GLOB_APPEND;
+  }
+  return true;
+}
+
+/*
+ * Special Commands
+ */
+
+// * Special Commands 1 (RedirectionCommand)
+
+bool _is_redirection_command(const char *cmd_line)
+{
+  char quote = '\0'; // the operators inside quotes are just text
+  for (const char *c = cmd_line; c && *c; ++c)
+  {
+    if (quote != '\0' || *c == '\'' || *c == '"')
+    {
+      quote = (quote == '\0') ? *c : ((*c == quote) ? '\0' : quote);
+    }
+    else if (*c == '<' || *c == '>')
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+RedirectionCommand::RedirectionCommand(const char *cmd_line)
+    : Command(cmd_line),
+      m_command(nullptr),
+      m_redirections()
+{
+  std::string command_str;
+  std::string error;
+  if (!m_redirections.parse(_trim(Command::m_remove_background_sign(cmd_line)), &command_str, &error))
+  {
+    std::cerr << "smash error: " << error << "\n";
+    throw std::logic_error("RedirectionCommand::RedirectionCommand");
+  }
+  if (isBackground())
+  {
+    command_str += "&";
+  }
+  m_command = SmallShell::getInstance().CreateCommand(command_str.c_str());
+  if (m_command == nullptr || !m_command->is_valid())
+  {
+    invalidate_command();
+    return;
+  }
+  // if it becomes a job, it's shown with its redirections
+  m_command->setJobCMDLine(getCMDLine());
+}
+
+RedirectionCommand::~RedirectionCommand()
+{
+  // the inner command may have become a job (in the background, or stopped)
+  Command::release(m_command);
+}
+
+void RedirectionCommand::execute()
+{
+  if (!m_redirections.open())
+  {
+    return;
+  }
+
+  if (m_command->acceptRedirections(m_redirections))
+  {
+    // the command redirects its children by itself, the descriptors of the smash stay as they are
+    m_command->execute();
+  }
+  else
+  {
+    // built in commands run in the smash itself, its descriptors are restored at the end of the scope
+    ScopedRedirection redirection(m_redirections);
+    if (redirection.isApplied())
+    {
+      m_command->execute();
+    }
+  }
+
+  // the children have their own copies by now
+  m_redirections.close();
+}
+
+bool RedirectionCommand::setTimeout(unsigned int seconds, const std::string &cmd_line)
+{
+  return m_command && m_command->setTimeout(seconds, cmd_line);
+}
+
+void RedirectionCommand::childStarted(pid_t pid, bool group) const
+{
+  if (m_command)
+  {
+    m_command->childStarted(pid, group);
+  }
+}
+
+void RedirectionCommand::setJobCMDLine(const std::string &cmd_line)
+{
+  if (m_command)
+  {
+    m_command->setJobCMDLine(cmd_line);
+  }
+}
+
+void RedirectionCommand::executeInChild()
+{
+  // already in a child (a pipeline stage), its own descriptors are redirected directly
+  if (m_redirections.open() && m_redirections.apply())
+  {
+    m_command->executeInChild();
+  }
+  _exit(EXIT_FAILURE);
+}
+
+// * Special Commands 2 (PipeCommand)
+
+bool _is_pipe_command(const char *cmd_line)
+{
+  if (std::string(cmd_line).find_first_of("|") != std::string::npos)
+  {
+    return true;
+  }
+  return false;
+}
+
+void PipeCommand::splitStages(const std::string &cmd_line, std::vector<std::string> *stages, std::vector<PipeType> *types)
+{
+  size_t stage_start = 0;
+  size_t index_of_line;
+  while ((index_of_line = cmd_line.find('|', stage_start)) != std::string::npos)
+  {
+    stages->push_back(_trim(cmd_line.substr(stage_start, index_of_line - stage_start)));
+    stage_start = index_of_line + 1;
+    if (stage_start < cmd_line.size() && cmd_line[stage_start] == '&') // "|&"
+    {
+      types->push_back(PipeType::Error);
+      ++stage_start;
+    }
+    else
+    {
+      types->push_back(PipeType::Standard);
+    }
+  }
+  stages->push_back(_trim(cmd_line.substr(stage_start)));
+}
+
+PipeCommand::PipeCommand(const char *cmd_line)
+    : Command(cmd_line),
+      m_stages(),
+      m_pipe_types()
+{
+  std::vector<std::string> stages;
+  splitStages(cmd_line, &stages, &m_pipe_types);
+  for (size_t i = 0; i < stages.size(); ++i)
+  {
+    Command *command = SmallShell::getInstance().CreateCommand(stages[i].c_str());
+    if (command == nullptr || !command->is_valid())
+    {
+      Command::release(command);
+      _release_stages(); // the d'tor is not called when the c'tor throws
+      throw std::logic_error("PipeCommand::PipeCommand");
+    }
+    m_stages.push_back(command);
+  }
+}
+
+PipeCommand::~PipeCommand()
+{
+  _release_stages();
+}
+
+void PipeCommand::_release_stages()
+{
+  // the stages only run in the children, they never become jobs by themselves (the whole pipeline does)
+  for (size_t i = 0; i < m_stages.size(); ++i)
+  {
+    Command::release(m_stages[i]);
+  }
+  m_stages.clear();
+}
+
+void PipeCommand::execute()
+{
+  enum PIPE
+  {
+    READ = 0,
     WRITE = 1
   };
 
-  enum STANDARD
+  enum STANDARD
+  {
+    IN = 0,
+    OUT = 1,
+    ERR = 2
+  };
+
+  // anything still buffered would be written again by every stage
+  std::cout.flush();
+
+  // all the stages run at the same time, in one process group (led by the first stage)
+  pid_t group = 0;
+  unsigned int started = 0;
+  int previous_read = -1; // the read end of the pipe from the previous stage
+  for (size_t i = 0; i < m_stages.size(); ++i)
+  {
+    int files[] = {-1, -1};
+    bool last = (i + 1 == m_stages.size());
+    if (!last && pipe2(files, O_CLOEXEC) == -1)
+    {
+      _perror("smash error: pipe failed");
+      break;
+    }
+
+    TraceScope fork_scope("fork");
+    pid_t pid = fork();
+    fork_scope.end();
+    if (pid == -1)
+    {
+      _perror("smash error: fork failed");
+      close(files[PIPE::READ]);
+      close(files[PIPE::WRITE]);
+      break;
+    }
+    if (pid == 0) // * son
+    {
+      setpgid(0, group);
+      SmallShell::getInstance().enterChild(); // the stages that don't exec
+      if (previous_read != -1)
+      {
+        dup2(previous_read, STANDARD::IN);
+        close(previous_read);
+      }
+      if (!last)
+      {
+        dup2(files[PIPE::WRITE], (m_pipe_types[i] == PipeType::Error) ? STANDARD::ERR : STANDARD::OUT);
+        close(files[PIPE::READ]);
+        close(files[PIPE::WRITE]);
+      }
+      m_stages[i]->executeInChild(); // with its own redirections (if any) on top of the pipes
+    }
+
+    // * parent, sets the group as well so it's set no matter who runs first
+    ++started;
+    if (group == 0)
+    {
+      group = pid;
+    }
+    setpgid(pid, group);
+    // a timed stage is killed alone (the group is the pipeline's)
+    m_stages[i]->childStarted(pid, false);
+    if (previous_read != -1)
+    {
+      close(previous_read);
+    }
+    if (!last)
+    {
+      close(files[PIPE::WRITE]); // only the stage writes to it, so the next one gets EOF when it's done
+    }
+    previous_read = files[PIPE::READ];
+  }
+  if (previous_read != -1) // a stage failed to start
+  {
+    close(previous_read);
+  }
+
+  if (group == 0)
+  {
+    return;
+  }
+  _schedule_timeout(group);
+  if (isBackground())
+  {
+    SmallShell::getInstance().getJobsList().addJob(this, group, JobsList::JobEntry::State::Running, 0, started);
+  }
+  else
+  {
+    // only the stages that started, if a fork failed on the way
+    SmallShell::getInstance().waitForeground(this, group, 0, started);
+  }
+}
+
+// * Special Commands 3 (ChmodCommand) , actually inherits from BuiltInCommand
+
+ChmodCommand::ChmodCommand(const char *cmd_line, const CommandTokens &tokens)
+    : BuiltInCommand(cmd_line, tokens)
+{
+  if (getArgs().size() != 2)
+  {
+    std::cerr << "smash error: chmod: invalid arguments\n";
+    throw std::logic_error("ChmodCommand::ChmodCommand");
+  }
+
+  std::string modes = getArgs().front();
+  std::string file_path = getArgs().back();
+
+  // if the string is NOT from 3 octal digits
+  if ((modes.size() != 3) || (modes.find_first_not_of("01234567") != std::string::npos))
+  {
+    std::cerr << "smash error: chmod: invalid arguments\n";
+    throw std::logic_error("ChmodCommand::ChmodCommand");
+  }
+}
+
+ChmodCommand::~ChmodCommand()
+{
+  // default
+}
+
+void ChmodCommand::execute()
+{
+  mode_t mode = static_cast<mode_t>(std::stoi(getArgs().front(), nullptr, 8)); // shouldn't throw
+
+  if (chmod(getArgs().back().c_str(), mode) == -1) // getArgs().back() is the file path
+  {
+    _perror("smash error: chmod failed");
+  }
+}
+
+/*
+ * Built In Commands
+ */
+
+BuiltInCommand::BuiltInCommand(const char *cmd_line, const CommandTokens &tokens)
+    : Command(cmd_line),
+      m_name(tokens.str(0)), // the dispatcher never creates a command from an empty line
+      m_args()
+{
+  m_args.reserve(tokens.size() - 1);
+  for (unsigned int i = 1; i < tokens.size(); ++i)
+  {
+    m_args.push_back(tokens.str(i));
+  }
+}
+
+BuiltInCommand::~BuiltInCommand()
+{
+  // default
+}
+
+// * BuiltInCommand 1 (ChangePromptCommand)
+
+ChangePromptCommand::ChangePromptCommand(const char *cmd_line, const CommandTokens &tokens)
+    : BuiltInCommand(cmd_line, tokens)
+{
+}
+
+ChangePromptCommand::~ChangePromptCommand()
+{
+  // default
+}
+
+void ChangePromptCommand::execute()
+{
+  // ? Any special checking for the name validity
+  SmallShell::getInstance().setPrompt(
+      (getArgs().size() == 0) ? SmallShell::DEFAULT_PROMPT : getArgs().front());
+}
+
+// * BuiltInCommand 2 (ShowPidCommand)
+ShowPidCommand::ShowPidCommand(const char *cmd_line, const CommandTokens &tokens)
+    : BuiltInCommand(cmd_line, tokens)
+{
+}
+
+ShowPidCommand::~ShowPidCommand()
+{
+  // default
+}
+
+void ShowPidCommand::execute()
+{
+  // not getpid(), since the command might run in a child (as a pipeline stage)
+  std::cout << "smash pid is " << SmallShell::getInstance().getPid() << '\n';
+}
+
+// * BuiltInCommand 3 (GetCurrDirCommand)
+GetCurrDirCommand::GetCurrDirCommand(const char *cmd_line, const CommandTokens &tokens)
+    : BuiltInCommand(cmd_line, tokens)
+{
+}
+
+GetCurrDirCommand::~GetCurrDirCommand()
+{
+  // default
+}
+
+void GetCurrDirCommand::execute()
+{
+  char path[COMMAND_MAX_PATH_LENGTH + 1];
+  // `getcwd()` writes the absolute pathname of the current working directory to the `path` array
+  if (getcwd(path, COMMAND_MAX_PATH_LENGTH + 1) != nullptr) // success
+  {
+    std::cout << std::string(path) << '\n';
+  }
+  else
+  {
+    // ? should we print an error
+    _perror("smash error: getcwd failed");
+  }
+}
+
+// * BuiltInCommand 4 (ChangeDirCommand)
+
+/* static variables */
+std::string ChangeDirCommand::OLD_PWD; // default c'tor will be called (not set)
+
+ChangeDirCommand::ChangeDirCommand(const char *cmd_line, const CommandTokens &tokens)
+    : BuiltInCommand(cmd_line, tokens)
+{
+  // 0 arguments will NOT be tested
+  if (getArgs().size() > 1) // more than one argument
+  {
+    std::cerr << "smash error: cd: too many arguments\n";
+    invalidate_command();
+  }
+}
+
+ChangeDirCommand::~ChangeDirCommand()
+{
+  // default
+}
+
+void ChangeDirCommand::execute()
+{
+  // 0 arguments for cd will NOT be tested
+
+  // get the current working directory
+  char cwd[COMMAND_MAX_PATH_LENGTH+1];
+  // `getcwd()` writes the absolute pathname of the current working directory to the `path` array
+  if (getcwd(cwd, COMMAND_MAX_PATH_LENGTH+1) == nullptr) // failure
+  {
+    _perror("smash error: getcwd failed");
+    return;
+  }
+  std::string curr_dir(cwd);
+
+  // the ctor guarantees there will be 1 argument only
+  if ("-" == getArgs().back())
+  {
+    if (OLD_PWD.empty())
+    {
+      std::cerr << "smash error: cd: OLDPWD not set\n";
+      return;
+    }
+    else
+    {
+      if (0 == chdir(OLD_PWD.c_str())) // success
+      {
+        OLD_PWD = curr_dir;
+      }
+      else
+      {
+        _perror("smash error: chdir failed");
+        return;
+      }
+    }
+  }
+  else if (".." == getArgs().back())
+  {
+    // get the parent directory
+    std::string parent_dir = get_parent_directory(cwd);
+    // change dir to the parent
+    if (0 == chdir(parent_dir.c_str())) // success
+    {
+      OLD_PWD = curr_dir;
+    }
+    else
+    {
+      _perror("smash error: chdir failed");
+    }
+  }
+  else // "normal path"
+  {
+    // change dir to the path given
+    if (0 == chdir(getArgs().front().c_str())) // success
+    {
+      OLD_PWD = curr_dir;
+    }
+    else
+    {
+      _perror("smash error: chdir failed");
+    }
+  }
+}
+
+/* methods */
+std::string ChangeDirCommand::get_parent_directory(const std::string &path) const
+{
+  size_t lastSlashPos = path.find_last_of("/");
+
+  // If there's no slash, or only one at the beginning (root), return as is or some indication
+  if (lastSlashPos == std::string::npos || (lastSlashPos == 0 && path.length() == 1))
+  {
+    return path; // No parent directory, or it's the root
+  }
+  else if (lastSlashPos == 0)
+  {
+    return "/"; // The parent directory is the root
+  }
+  else
+  {
+    return path.substr(0, lastSlashPos); // Return the substring up to the last slash
+  }
+}
+
+// * BuiltInCommand 5 (JobsCommand)
+
+JobsCommand::JobsCommand(const char *cmd_line, const CommandTokens &tokens)
+    : BuiltInCommand(cmd_line, tokens),
+      m_verbose(!getArgs().empty() && getArgs().front() == "-v")
+{
+}
+
+JobsCommand::~JobsCommand()
+{
+  // default
+}
+
+void JobsCommand::execute()
+{
+  // TODO: figure out what are they yapping about on " if the job was added again then the timer should reset. "
+  // getJobsList() always return an updated JobsList
+  SmallShell::getInstance().getJobsList().printJobsList(m_verbose);
+}
+
+// * BuiltInCommand 6 (ForegroundCommand)
+
+ForegroundCommand::ForegroundCommand(const char *cmd_line, const CommandTokens &tokens)
+    : BuiltInCommand(cmd_line, tokens)
+{
+  JobsList &jobslist = SmallShell::getInstance().getJobsList();
+
+  if (getArgs().size() == 0 && jobslist.size() == 0)
+  {
+    std::cerr << "smash error: fg: jobs list is empty\n";
+    throw std::logic_error("ForegroundCommand::ForegroundCommand");
+  }
+
+  try
+  {
+    if (getArgs().size() > 0)
+    {
+      m_id = std::stoi(getArgs().front());
+    }
+    else
+    {
+      m_id = jobslist.getLastJob(nullptr)->getJobID();
+    }
+  }
+  catch (...)
+  {
+    std::cerr << "smash error: fg: invalid arguments\n";
+    throw std::logic_error("ForegroundCommand::ForegroundCommand");
+  }
+
+  if (getArgs().size() > 0 && jobslist.getJobById(m_id) == nullptr)
+  {
+    std::cerr << "smash error: fg: job-id " << m_id << " does not exist\n";
+    throw std::logic_error("ForegroundCommand::ForegroundCommand");
+  }
+
+  if (getArgs().size() > 1)
+  {
+    std::cerr << "smash error: fg: invalid arguments\n";
+    throw std::logic_error("ForegroundCommand::ForegroundCommand");
+  }
+}
+
+ForegroundCommand::~ForegroundCommand()
+{
+  // default
+}
+
+void ForegroundCommand::execute()
+{
+  JobsList &jobslist = SmallShell::getInstance().getJobsList();
+  JobsList::JobEntry *job = jobslist.getJobById(m_id);
+  if (!job)
+  {
+    return;
+  }
+  pid_t pid = job->getJobPid();
+  unsigned int processes = job->getProcesses();
+  bool stopped = (job->getState() == JobsList::JobEntry::State::Stopped);
+
+  std::cout << job->getCommand()->getJobCMDLine() << " " << pid << "\n";
+  if (stopped && !jobslist.sendSignal(m_id, SIGCONT, true)) // the whole process group of the job
+  {
+    _perror("smash error: kill failed");
+  }
+  Command *command = jobslist.takeJob(m_id);
+
+  // if it gets stopped again it goes back to the list with the same job id (and stays a job)
+  SmallShell::getInstance().waitForeground(command, pid, m_id, processes);
+  Command::release(command);
+}
+
+// * BuiltInCommand 11 (BackgroundCommand)
+
+BackgroundCommand::BackgroundCommand(const char *cmd_line, const CommandTokens &tokens)
+    : BuiltInCommand(cmd_line, tokens)
+{
+  JobsList &jobslist = SmallShell::getInstance().getJobsList();
+
+  if (getArgs().size() > 0)
+  {
+    try
+    {
+      m_id = std::stoi(getArgs().front());
+    }
+    catch (...)
+    {
+      std::cerr << "smash error: bg: invalid arguments\n";
+      throw std::logic_error("BackgroundCommand::BackgroundCommand");
+    }
+
+    JobsList::JobEntry *job = jobslist.getJobById(m_id);
+    if (job == nullptr)
+    {
+      std::cerr << "smash error: bg: job-id " << m_id << " does not exist\n";
+      throw std::logic_error("BackgroundCommand::BackgroundCommand");
+    }
+    if (job->getState() != JobsList::JobEntry::State::Stopped)
+    {
+      std::cerr << "smash error: bg: job-id " << m_id << " is already running in the background\n";
+      throw std::logic_error("BackgroundCommand::BackgroundCommand");
+    }
+  }
+  else if (jobslist.getLastStoppedJob(&m_id) == nullptr)
+  {
+    std::cerr << "smash error: bg: there is no stopped jobs to resume\n";
+    throw std::logic_error("BackgroundCommand::BackgroundCommand");
+  }
+
+  if (getArgs().size() > 1)
+  {
+    std::cerr << "smash error: bg: invalid arguments\n";
+    throw std::logic_error("BackgroundCommand::BackgroundCommand");
+  }
+}
+
+BackgroundCommand::~BackgroundCommand()
+{
+  // default
+}
+
+void BackgroundCommand::execute()
+{
+  JobsList &jobslist = SmallShell::getInstance().getJobsList();
+  JobsList::JobEntry *job = jobslist.getJobById(m_id);
+  if (!job)
+  {
+    return;
+  }
+
+  std::cout << job->getCommand()->getJobCMDLine() << " " << job->getJobPid() << "\n";
+  if (!jobslist.sendSignal(m_id, SIGCONT, true)) // the whole process group of the job
+  {
+    _perror("smash error: kill failed");
+    return;
+  }
+  // don't wait for the SIGCHLD, the job is running from now on
+  jobslist.setJobState(m_id, JobsList::JobEntry::State::Running);
+}
+
+// * BuiltInCommand 7 (QuitCommand)
+
+QuitCommand::QuitCommand(const char *cmd_line, const CommandTokens &tokens)
+    : BuiltInCommand(cmd_line, tokens)
+{
+}
+
+QuitCommand::~QuitCommand()
+{
+  // default
+}
+
+void QuitCommand::execute()
+{
+  if (getArgs().size() > 0)
+  {
+    if (getArgs().front() == "kill")
+    {
+      SmallShell::getInstance().getJobsList().killAllJobs();
+    }
+    // else, if other arguments other than "kill" were provided they will be ignored
+  }
+  // exit the smash
+  exit(0);
+}
+
+// * BuiltInCommand 8 (KillCommand)
+
+KillCommand::KillCommand(const char *cmd_line, const CommandTokens &tokens)
+    : BuiltInCommand(cmd_line, tokens)
+{
+  if (getArgs().size() != 2)
+  {
+    std::cerr << "smash error: kill: invalid arguments\n";
+    invalidate_command();
+  }
+
+  try
+  {
+    // should remove the - before the signal number before std::stoi
+    std::string signal_string = getArgs().front();
+    if (!signal_string.empty() && signal_string.front() == '-')
+    {
+      signal_string.erase(0, 1); // Erase the first character
+    }
+    else // signal didn't have a dash before it
+    {
+      std::cerr << "smash error: kill: invalid arguments\n";
+      invalidate_command();
+    }
+
+    m_signal_number = std::stoi(signal_string);
+    m_job_id = std::stoi(getArgs().back());
+  }
+  catch (const std::exception &e)
+  {
+    std::cerr << "smash error: kill: invalid arguments\n";
+    invalidate_command();
+  }
+
+  // check if the job id actually exists
+  if (SmallShell::getInstance().getJobsList().getJobById(m_job_id) == nullptr)
+  {
+    std::cerr << "smash error: kill: job-id " << m_job_id << " does not exist\n";
+    invalidate_command();
+  }
+}
+
+KillCommand::~KillCommand()
+{
+  // default
+}
+
+void KillCommand::execute()
+{
+  JobsList &job_list = SmallShell::getInstance().getJobsList();
+  JobsList::JobEntry *job = job_list.getJobById(m_job_id);
+  if (job != nullptr)
+  {
+    if (!job_list.sendSignal(m_job_id, m_signal_number)) // failure
+    {
+      _perror("smash error: kill failed");
+    }
+    else
+    {
+      std::cout << "signal number " << m_signal_number << " was sent to pid " << job->getJobPid() << '\n';
+    }
+  }
+}
+
+// * BuiltInCommand 9 (SourceCommand)
+
+SourceCommand::SourceCommand(const char *cmd_line, const CommandTokens &tokens)
+    : BuiltInCommand(cmd_line, tokens)
+{
+  if (getArgs().size() != 1)
+  {
+    std::cerr << "smash error: source: invalid arguments\n";
+    invalidate_command();
+  }
+}
+
+SourceCommand::~SourceCommand()
+{
+  // default
+}
+
+void SourceCommand::execute()
+{
+  SmallShell::getInstance().runScript(getArgs().front());
+}
+
+// * BuiltInCommand 10 (HashCommand)
+
+HashCommand::HashCommand(const char *cmd_line, const CommandTokens &tokens)
+    : BuiltInCommand(cmd_line, tokens)
+{
+  if (getArgs().size() > 1 || (getArgs().size() == 1 && getArgs().front() != "-r"))
+  {
+    std::cerr << "smash error: hash: invalid arguments\n";
+    invalidate_command();
+  }
+}
+
+HashCommand::~HashCommand()
+{
+  // default
+}
+
+void HashCommand::execute()
+{
+  CommandPathCache &path_cache = SmallShell::getInstance().getPathCache();
+  if (getArgs().size() == 1) // -r
+  {
+    path_cache.clear();
+  }
+  else
+  {
+    path_cache.print();
+  }
+}
+
+// * BuiltInCommand 12 (CatCommand)
+
+/**
+ * Copies everything from in to out, inside the kernel whenever the kind of the two files allows it.
+ * A ctrl-C between two chunks stops the copy and sets interrupted (what was copied so far stays).
+ * Returns false on failure (with errno set).
+ */
+bool _copy_fd(int in, int out, bool *interrupted)
+{
+  enum class CopyMethod
+  {
+    CopyFileRange, // file to file
+    Splice,        // into a pipe, or from a pipe into a socket
+    SendFile,      // from a file to anything else
+    ReadWrite      // through a buffer, when nothing else works
+  };
+  const size_t CHUNK_SIZE = 1 << 20;
+
+  struct stat in_status, out_status;
+  if (fstat(in, &in_status) == -1 || fstat(out, &out_status) == -1)
+  {
+    return false;
+  }
+  CopyMethod method = CopyMethod::ReadWrite;
+  if (S_ISREG(in_status.st_mode) && S_ISREG(out_status.st_mode))
+  {
+    method = CopyMethod::CopyFileRange;
+  }
+  // not from a pipe into a file: a splice that blocks on the pipe writes at the offset the file had when it started,
+  // over whatever the smash (which shares the offset) wrote meanwhile
+  else if (S_ISFIFO(out_status.st_mode) || (S_ISFIFO(in_status.st_mode) && S_ISSOCK(out_status.st_mode)))
+  {
+    method = CopyMethod::Splice;
+  }
+  else if (S_ISREG(in_status.st_mode))
+  {
+    method = CopyMethod::SendFile;
+  }
+
+  bool copied_any = false;
+  while (true)
+  {
+    ssize_t copied;
+    switch (method)
+    {
+    case CopyMethod::CopyFileRange:
+      copied = copy_file_range(in, nullptr, out, nullptr, CHUNK_SIZE, 0);
+      break;
+    case CopyMethod::Splice:
+      copied = splice(in, nullptr, out, nullptr, CHUNK_SIZE, SPLICE_F_MOVE | SPLICE_F_MORE);
+      break;
+    case CopyMethod::SendFile:
+      copied = sendfile(out, in, nullptr, CHUNK_SIZE);
+      break;
+    default: // CopyMethod::ReadWrite
+    {
+      static char buffer[1 << 16];
+      copied = read(in, buffer, sizeof(buffer));
+      for (ssize_t written = 0; copied > 0 && written < copied;)
+      {
+        ssize_t result = write(out, buffer + written, copied - written);
+        if (result == -1 && errno != EINTR)
+        {
+          return false;
+        }
+        written += (result > 0) ? result : 0;
+      }
+    }
+    }
+
+    if (copied > 0)
+    {
+      copied_any = true;
+      // the smash itself may be copying (a regular file), nothing else stops it
+      if (takeTerminalSignal() == SIGINT)
+      {
+        *interrupted = true;
+        return true;
+      }
+    }
+    else if (copied == 0) // EOF
+    {
+      return true;
+    }
+    else if (errno == EINTR)
+    {
+      continue;
+    }
+    // the kernel can refuse some combinations (e.g. O_APPEND output, other file systems), nothing was copied yet
+    else if (!copied_any && method != CopyMethod::ReadWrite &&
+             (errno == EINVAL || errno == EBADF || errno == EXDEV || errno == ENOSYS || errno == EOPNOTSUPP))
+    {
+      method = CopyMethod::ReadWrite;
+    }
+    else
+    {
+      return false;
+    }
+  }
+}
+
+CatCommand::CatCommand(const char *cmd_line, const CommandTokens &tokens)
+    : BuiltInCommand(cmd_line, tokens),
+      m_redirections()
+{
+}
+
+CatCommand::~CatCommand()
+{
+  // default
+}
+
+bool CatCommand::isSupported(const CommandTokens &tokens, bool background)
+{
+  if (background) // built ins don't run in the background
+  {
+    return false;
+  }
+  for (unsigned int i = 1; i < tokens.size(); ++i)
+  {
+    // an option ("-" alone is the standard input), or wildcards to expand
+    if ((tokens[i][0] == '-' && tokens.length(i) > 1) || strpbrk(tokens[i], "*?"))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+void CatCommand::execute()
+{
+  pid_t pid;
+  {
+    // what was printed before should come before the copied bytes (flushed by the redirection)
+    ScopedRedirection redirection(m_redirections);
+    if (!redirection.isApplied())
+    {
+      return;
+    }
+    if (!_reads_stream())
+    {
+      _copy_files();
+      return;
+    }
+
+    // the smash can't stop a copy that never ends, but it can stop a process
+    TraceScope fork_scope("fork");
+    pid = fork();
+    fork_scope.end();
+    if (pid == -1)
+    {
+      _perror("smash error: fork failed");
+      return;
+    }
+    if (pid == 0) // * son, in its own process group like any other foreground command
+    {
+      setpgid(0, 0);
+      SmallShell::getInstance().enterChild();
+      executeInChild();
+    }
+    setpgid(pid, pid); // set by both, so it's set no matter who runs first
+  }
+
+  // only the child is redirected, the messages of the smash (ctrl-C, ...) go to its own output
+  _schedule_timeout(pid);
+  SmallShell::getInstance().waitForeground(this, pid);
+}
+
+bool CatCommand::acceptRedirections(const RedirectionPlan &plan)
+{
+  m_redirections = plan;
+  return true;
+}
+
+bool CatCommand::setTimeout(unsigned int seconds, const std::string &cmd_line)
+{
+  // regular files are copied right away, so only the copy that may never end is timed
+  return Command::setTimeout(seconds, cmd_line);
+}
+
+void CatCommand::executeInChild()
+{
+  // already in a child, no need for another one
+  bool copied = _copy_files();
+  std::cout.flush();
+  _exit(copied ? 0 : 1);
+}
+
+bool CatCommand::_reads_stream() const
+{
+  if (getArgs().empty())
+  {
+    struct stat input_status;
+    return fstat(STDIN_FILENO, &input_status) == -1 || !S_ISREG(input_status.st_mode);
+  }
+  for (const std::string &path : getArgs())
+  {
+    struct stat input_status;
+    int result = (path == "-") ? fstat(STDIN_FILENO, &input_status) : stat(path.c_str(), &input_status);
+    if (result == 0 && !S_ISREG(input_status.st_mode)) // a missing file is only reported when it's opened
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool CatCommand::_copy_files() const
+{
+  static const std::vector<std::string> STANDARD_INPUT(1, "-");
+  // a file copied into itself would grow for as long as it's copied
+  struct stat output_status;
+  bool output_is_file = fstat(STDOUT_FILENO, &output_status) == 0 && S_ISREG(output_status.st_mode);
+  takeTerminalSignal(); // a ctrl-C from before is not for this copy
+  bool copied = true;
+  bool interrupted = false;
+  for (const std::string &path : getArgs().empty() ? STANDARD_INPUT : getArgs())
+  {
+    if (interrupted)
+    {
+      break;
+    }
+    int fd = (path == "-") ? STDIN_FILENO : open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat input_status;
+    if (fd != -1 && output_is_file && fstat(fd, &input_status) == 0 && input_status.st_dev == output_status.st_dev &&
+        input_status.st_ino == output_status.st_ino)
+    {
+      std::cerr << "smash error: cat: " << path << ": input file is output file\n";
+      copied = false;
+    }
+    else if (fd == -1 || !_copy_fd(fd, STDOUT_FILENO, &interrupted))
+    {
+      std::cerr << "smash error: cat: " << path << ": " << strerror(errno) << "\n";
+      copied = false;
+    }
+    if (fd != -1 && fd != STDIN_FILENO && close(fd) == -1)
+    {
+      _perror("smash error: close failed");
+    }
+  }
+  return copied;
+}
+
+// * BuiltInCommand 13 (ParallelCommand)
+
+ParallelCommand::ParallelCommand(const char *cmd_line, const CommandTokens &tokens)
+    : BuiltInCommand(cmd_line, tokens),
+      m_slots(0),
+      m_path()
+{
+  std::vector<std::string>::const_iterator arg = getArgs().begin();
+  if (arg != getArgs().end() && *arg == "-j")
+  {
+    ++arg;
+    char *end = nullptr;
+    long slots = (arg != getArgs().end()) ? strtol(arg->c_str(), &end, 10) : 0;
+    if (arg == getArgs().end() || *end != '\0' || slots <= 0)
+    {
+      std::cerr << "smash error: parallel: invalid arguments\n";
+      throw std::logic_error("ParallelCommand::ParallelCommand");
+    }
+    m_slots = slots;
+    ++arg;
+  }
+  if (arg != getArgs().end())
+  {
+    m_path = *arg++;
+  }
+  if (arg != getArgs().end())
+  {
+    std::cerr << "smash error: parallel: invalid arguments\n";
+    throw std::logic_error("ParallelCommand::ParallelCommand");
+  }
+  if (m_slots == 0)
+  {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    m_slots = (cpus > 0) ? cpus : 1;
+  }
+}
+
+ParallelCommand::~ParallelCommand()
+{
+  // default
+}
+
+bool ParallelCommand::_read_lines(std::vector<std::string> *lines) const
+{
+  // read(2) and not std::cin, which may have buffered more of the input of the smash
+  int fd = m_path.empty() ? STDIN_FILENO : open(m_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+  {
+    _perror("smash error: open failed");
+    return false;
+  }
+  std::string content;
+  char buffer[1 << 16];
+  ssize_t bytes;
+  while ((bytes = read(fd, buffer, sizeof(buffer))) != 0)
+  {
+    if (bytes == -1 && errno == EINTR)
+    {
+      continue;
+    }
+    if (bytes == -1)
+    {
+      _perror("smash error: read failed");
+      break;
+    }
+    content.append(buffer, bytes);
+  }
+  if (fd != STDIN_FILENO)
+  {
+    close(fd);
+  }
+  if (bytes == -1)
+  {
+    return false;
+  }
+
+  size_t start = 0;
+  while (start < content.size())
+  {
+    size_t end = content.find('\n', start);
+    end = (end == std::string::npos) ? content.size() : end;
+    lines->push_back(content.substr(start, end - start));
+    start = end + 1;
+  }
+  return true;
+}
+
+int ParallelCommand::_wait_for_children()
+{
+  // the signals are only let in while ppoll sleeps, so one that arrives right before it is not missed
+  sigset_t signals, previous_mask;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGCHLD);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTSTP);
+  sigaddset(&signals, SIGALRM);
+  sigprocmask(SIG_BLOCK, &signals, &previous_mask);
+  SmallShell::getInstance().getTimeouts().poll(); // the timed lines
+  std::cout.flush(); // before the messages of the ctrl-C / ctrl-Z handlers
+  int terminal_signal = takeTerminalSignal();
+  if (terminal_signal == 0)
+  {
+    // readable until the jobs list takes the notifications
+    struct pollfd notifications = {getChildNotificationsFd(), POLLIN, 0};
+    if (ppoll(&notifications, 1, nullptr, &previous_mask) == -1 && errno != EINTR)
+    {
+      _perror("smash error: ppoll failed");
+      terminal_signal = -1;
+    }
+    else
+    {
+      terminal_signal = takeTerminalSignal();
+    }
+  }
+  sigprocmask(SIG_SETMASK, &previous_mask, nullptr);
+  return terminal_signal;
+}
+
+pid_t ParallelCommand::_launch(Command *command) const
+{
+  TraceScope fork_scope("fork");
+  pid_t pid = fork();
+  fork_scope.end();
+  if (pid == -1)
+  {
+    _perror("smash error: fork failed");
+  }
+  else if (pid == 0) // * son, in its own process group like any other job
+  {
+    setpgid(0, 0);
+    SmallShell::getInstance().enterChild(); // the lines that don't exec
+    command->executeInChild();
+  }
+  else
+  {
+    setpgid(pid, pid); // set by both, so it's set no matter who runs first
+    command->childStarted(pid, true);
+  }
+  return pid;
+}
+
+void ParallelCommand::execute()
+{
+  std::vector<std::string> lines;
+  if (!_read_lines(&lines))
+  {
+    return;
+  }
+
+  SmallShell &smash = SmallShell::getInstance();
+  JobsList &jobs = smash.getJobsList();
+  std::unordered_map<pid_t, std::string> running; // the command lines, the commands themselves belong to the jobs list
+  takeTerminalSignal(); // a ctrl-C from before is not for these lines
+  unsigned int total = 0;
+  unsigned int failed = 0;
+  std::vector<std::string>::const_iterator next = lines.begin();
+  while (next != lines.end() || !running.empty())
+  {
+    // fill the free slots
+    while (running.size() < m_slots && next != lines.end())
+    {
+      const std::string &line = *next++;
+      if (_trim(line).empty())
+      {
+        continue;
+      }
+      ++total;
+      Command *command = smash.CreateCommand(line.c_str());
+      if (command == nullptr || !command->is_valid())
+      {
+        ++failed;
+        std::cout << "smash: parallel: " << _trim(line) << " is not a valid command\n";
+        Command::release(command);
+        continue;
+      }
+      std::cout.flush(); // anything still buffered would be written again by the child
+      pid_t pid = _launch(command);
+      if (pid == -1)
+      {
+        ++failed;
+        delete command;
+        continue;
+      }
+      // the jobs list reaps children whenever it's updated, even the ones that were not added yet
+      jobs.keepExitStatus(pid);
+      running[pid] = command->getCMDLine();
+      jobs.addJob(command, pid);
+    }
+
+    // collect the lines that finished (some of them may have been reaped while the others were added)
+    bool finished = false;
+    for (std::unordered_map<pid_t, std::string>::iterator it = running.begin(); it != running.end();)
+    {
+      int status;
+      if (!jobs.takeExitStatus(it->first, &status))
+      {
+        JobsList::JobEntry *job = jobs.getJobByPid(it->first);
+        if (job && job->getState() == JobsList::JobEntry::State::Stopped) // it stays a job, resumed with fg or bg
+        {
+          std::cout << "smash: parallel: " << it->second << " was stopped\n";
+          jobs.forgetExitStatus(it->first);
+          it = running.erase(it);
+          finished = true;
+          continue;
+        }
+        ++it;
+        continue;
+      }
+      if (WIFEXITED(status) && WEXITSTATUS(status) != 0)
+      {
+        ++failed;
+        std::cout << "smash: parallel: " << it->second << " exited with status " << WEXITSTATUS(status) << "\n";
+      }
+      else if (WIFSIGNALED(status))
+      {
+        ++failed;
+        std::cout << "smash: parallel: " << it->second << " was killed by signal " << WTERMSIG(status) << "\n";
+      }
+      JobsList::JobEntry *job = jobs.getJobByPid(it->first); // still there if it was reaped before it was added
+      if (job)
+      {
+        jobs.removeJobById(job->getJobID());
+      }
+      it = running.erase(it);
+      finished = true;
+    }
+    if (finished || running.empty())
+    {
+      continue;
+    }
+
+    // the children are reaped by the jobs list, which applies the state changes of all the jobs as usual
+    // (the stages of a background pipeline are only known to be its own until they are reaped)
+    int terminal_signal = _wait_for_children();
+    if (terminal_signal == -1)
+    {
+      break;
+    }
+    if (terminal_signal != 0)
+    {
+      // the lines are not the foreground process, so the smash handlers could not reach them
+      next = lines.end();
+      for (std::unordered_map<pid_t, std::string>::const_iterator it = running.begin(); it != running.end(); ++it)
+      {
+        JobsList::JobEntry *job = jobs.getJobByPid(it->first);
+        if (job && !jobs.sendSignal(job->getJobID(), (terminal_signal == SIGINT) ? SIGKILL : SIGSTOP, true))
+        {
+          _perror("smash error: kill failed");
+        }
+      }
+    }
+    jobs.removeFinishedJobs();
+  }
+
+  std::cout << "smash: parallel: " << total << " commands, " << failed << " failed\n";
+}
+
+// * BuiltInCommand 14 (TimeoutCommand)
+
+TimeoutCommand::TimeoutCommand(const char *cmd_line, const CommandTokens &tokens)
+    : BuiltInCommand(cmd_line, tokens),
+      m_command(nullptr)
+{
+  char *end = nullptr;
+  long seconds = (getArgs().size() >= 2) ? strtol(getArgs().front().c_str(), &end, 10) : -1;
+  if (seconds < 0 || *end != '\0')
+  {
+    std::cerr << "smash error: timeout: invalid arguments\n";
+    throw std::logic_error("TimeoutCommand::TimeoutCommand");
+  }
+
+  // the command is the rest of the line (with its background sign), after the duration
+  std::string line(cmd_line);
+  size_t start = line.find_first_of(WHITESPACE, line.find_first_not_of(WHITESPACE));
+  start = line.find_first_of(WHITESPACE, line.find_first_not_of(WHITESPACE, start));
+  m_command = SmallShell::getInstance().CreateCommand(_trim(line.substr(start)).c_str());
+  if (m_command == nullptr || !m_command->is_valid())
+  {
+    invalidate_command();
+    return;
+  }
+  if (!m_command->setTimeout(seconds, getCMDLine()))
+  {
+    std::cerr << "smash error: timeout: " << _trim(line.substr(start)) << " is a built in command\n";
+    invalidate_command();
+    return;
+  }
+  m_command->setJobCMDLine(getCMDLine());
+}
+
+TimeoutCommand::~TimeoutCommand()
+{
+  // the timed command may have become a job (in the background, or stopped)
+  Command::release(m_command);
+}
+
+void TimeoutCommand::execute()
+{
+  m_command->execute();
+}
+
+void TimeoutCommand::executeInChild()
+{
+  // the deadline was scheduled by the parent, which waits for this process (see childStarted)
+  m_command->executeInChild();
+  _exit(EXIT_FAILURE); // not reached, a virtual call is not known to be [[noreturn]]
+}
+
+void TimeoutCommand::childStarted(pid_t pid, bool group) const
+{
+  m_command->childStarted(pid, group);
+}
+
+void TimeoutCommand::setJobCMDLine(const std::string &cmd_line)
+{
+  m_command->setJobCMDLine(cmd_line);
+}
+
+// * BuiltInCommand 15 (HistoryCommand)
+
+HistoryCommand::HistoryCommand(const char *cmd_line, const CommandTokens &tokens)
+    : BuiltInCommand(cmd_line, tokens),
+      m_text()
+{
+  if (getArgs().empty())
+  {
+    return;
+  }
+  if (getArgs().front() != "-s" || getArgs().size() < 2)
+  {
+    std::cerr << "smash error: history: invalid arguments\n";
+    throw std::logic_error("HistoryCommand::HistoryCommand");
+  }
+  // the text is the rest of the line (it may have spaces), after the -s
+  std::string line = _trim(Command::m_remove_background_sign(cmd_line));
+  m_text = _trim(line.substr(line.find("-s") + 2));
+}
+
+HistoryCommand::~HistoryCommand()
+{
+  // default
+}
+
+void HistoryCommand::execute()
+{
+  CommandHistory &history = SmallShell::getInstance().getHistory();
+  if (m_text.empty())
+  {
+    history.print();
+  }
+  else
+  {
+    history.search(m_text);
+  }
+}
+
+// * BuiltInCommand 16 (TimeCommand)
+
+TimeCommand::TimeCommand(const char *cmd_line, const CommandTokens &tokens)
+    : BuiltInCommand(cmd_line, tokens),
+      m_command(nullptr)
+{
+  if (getArgs().empty())
+  {
+    std::cerr << "smash error: time: invalid arguments\n";
+    throw std::logic_error("TimeCommand::TimeCommand");
+  }
+
+  // the command is the rest of the line (with its background sign)
+  std::string line(cmd_line);
+  size_t start = line.find_first_of(WHITESPACE, line.find_first_not_of(WHITESPACE));
+  m_command = SmallShell::getInstance().CreateCommand(_trim(line.substr(start)).c_str());
+  if (m_command == nullptr || !m_command->is_valid())
+  {
+    invalidate_command();
+    return;
+  }
+  m_command->setJobCMDLine(getCMDLine());
+}
+
+TimeCommand::~TimeCommand()
+{
+  // the timed command may have become a job (in the background, or stopped)
+  Command::release(m_command);
+}
+
+bool TimeCommand::setTimeout(unsigned int seconds, const std::string &cmd_line)
+{
+  return m_command && m_command->setTimeout(seconds, cmd_line);
+}
+
+void TimeCommand::setJobCMDLine(const std::string &cmd_line)
+{
+  if (m_command)
+  {
+    m_command->setJobCMDLine(cmd_line);
+  }
+}
+
+void TimeCommand::execute()
+{
+  SmallShell &smash = SmallShell::getInstance();
+  smash.takeForegroundUsage(); // the processes that exited before are not ours
+  struct rusage before, after;
+  getrusage(RUSAGE_SELF, &before);
+  double start = _monotonic_seconds();
+
+  m_command->execute();
+
+  double wall_seconds = _monotonic_seconds() - start;
+  getrusage(RUSAGE_SELF, &after);
+  ResourceUsage usage = smash.takeForegroundUsage();
+  // built in commands run in the smash itself, so what it used meanwhile is added (but not its own resident set)
+  ResourceUsage own_before, own_after;
+  own_before.add(before);
+  own_after.add(after);
+  usage.user_seconds += own_after.user_seconds - own_before.user_seconds;
+  usage.system_seconds += own_after.system_seconds - own_before.system_seconds;
+  usage.context_switches += own_after.context_switches - own_before.context_switches;
+
+  std::cout << "smash: time: ";
+  usage.print(wall_seconds);
+  std::cout << "\n";
+}
+
+void TimeCommand::executeInChild()
+{
+  // the parent started the clock, and prints the usage that wait4 reports for this process (see childStarted)
+  m_command->executeInChild();
+  _exit(EXIT_FAILURE); // not reached, a virtual call is not known to be [[noreturn]]
+}
+
+void TimeCommand::childStarted(pid_t pid, bool group) const
+{
+  SmallShell::getInstance().timeChild(pid);
+  m_command->childStarted(pid, group);
+}
+
+// * BuiltInCommand 17 (TraceCommand)
+
+/* static variables */
+const char *const TraceCommand::DEFAULT_PATH = "smash_trace.json";
+
+TraceCommand::TraceCommand(const char *cmd_line, const CommandTokens &tokens)
+    : BuiltInCommand(cmd_line, tokens),
+      m_on(false),
+      m_path()
+{
+  const std::vector<std::string> &args = getArgs();
+  if (args.size() == 1 && args[0] == "off")
+  {
+    return;
+  }
+  if (args.empty() || args.size() > 2 || args[0] != "on")
+  {
+    std::cerr << "smash error: trace: invalid arguments\n";
+    throw std::logic_error("TraceCommand::TraceCommand");
+  }
+  m_on = true;
+  m_path = (args.size() == 2) ? args[1] : "";
+}
+
+TraceCommand::~TraceCommand()
+{
+  // default
+}
+
+void TraceCommand::execute()
+{
+  Tracer &tracer = Tracer::getInstance();
+  if (m_on)
+  {
+    if (Tracer::ENABLED)
+    {
+      std::cerr << "smash error: trace: tracing is already on\n";
+      return;
+    }
+    std::string path = !m_path.empty() ? m_path : (!tracer.getPath().empty() ? tracer.getPath() : DEFAULT_PATH);
+    tracer.start(path);
+    return;
+  }
+
+  if (!Tracer::ENABLED)
+  {
+    std::cerr << "smash error: trace: tracing is off\n";
+    return;
+  }
+  size_t events = tracer.size();
+  if (tracer.stop())
+  {
+    std::cout << "smash: trace: " << events << " events written to " << tracer.getPath() << "\n";
+  }
+}
+
+/* *
+ * The CommandHistory class
+ */
+
+const char CommandHistory::INDEX_MAGIC[8] = {'s', 'm', 'a', 's', 'h', 'i', 'x', '1'};
+
+CommandHistory::CommandHistory()
+    : m_path(),
+      m_fd(-1),
+      m_data(nullptr),
+      m_size(0),
+      m_entries(),
+      m_scanned_size(0),
+      m_index_data(nullptr),
+      m_index_size(0),
+      m_index_opened(false),
+      m_index_entries(0),
+      m_index_offsets(nullptr),
+      m_index_trigrams(nullptr),
+      m_index_trigrams_count(0),
+      m_index_postings(nullptr),
+      m_trigrams(),
+      m_indexed_entries(0)
+{
+}
+
+CommandHistory::~CommandHistory()
+{
+  _close_index();
+  if (m_data)
+  {
+    munmap(const_cast<char *>(m_data), m_size);
+  }
+  if (m_fd != -1)
+  {
+    close(m_fd);
+  }
+}
+
+void CommandHistory::open(const std::string &path)
+{
+  m_path = path;
+}
+
+bool CommandHistory::_open_log()
+{
+  if (m_fd != -1)
+  {
+    return true;
+  }
+  // O_APPEND: every line is added at the end in one write, even with a few smash sessions at once
+  m_fd = m_path.empty() ? memfd_create("smash-history", MFD_CLOEXEC)
+                        : ::open(m_path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+  if (m_fd == -1)
+  {
+    _perror("smash error: history: open failed");
+    m_path.clear(); // keeps the history of the session at least
+    m_fd = memfd_create("smash-history", MFD_CLOEXEC);
+  }
+  return m_fd != -1;
+}
+
+void CommandHistory::add(const std::string &cmd_line)
+{
+  if (_trim(cmd_line).empty() || !_open_log())
+  {
+    return;
+  }
+  std::string entry = cmd_line + "\n";
+  if (write(m_fd, entry.data(), entry.size()) == -1)
+  {
+    _perror("smash error: history: write failed");
+  }
+}
+
+bool CommandHistory::_load()
+{
+  if (!_open_log())
+  {
+    return false;
+  }
+  struct stat log_status;
+  if (fstat(m_fd, &log_status) == -1)
+  {
+    _perror("smash error: history: fstat failed");
+    return false;
+  }
+  size_t size = log_status.st_size;
+  if (size == m_size) // nothing new
+  {
+    return true;
+  }
+
+  if (m_data && munmap(const_cast<char *>(m_data), m_size) == -1)
+  {
+    _perror("smash error: history: munmap failed");
+  }
+  void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+  if (data == MAP_FAILED)
+  {
+    _perror("smash error: history: mmap failed");
+    m_data = nullptr;
+    m_size = 0;
+    return false;
+  }
+  m_data = static_cast<const char *>(data);
+  m_size = size;
+  // the entries in the index file are not scanned at all
+  _open_index();
+  _scan();
+  return true;
+}
+
+void CommandHistory::_scan()
+{
+  // only whole lines are entries (a line may still be in the middle of its write)
+  const char *end;
+  while (m_scanned_size < m_size &&
+         (end = static_cast<const char *>(memchr(m_data + m_scanned_size, '\n', m_size - m_scanned_size))))
+  {
+    m_entries.push_back(m_scanned_size);
+    m_scanned_size = end + 1 - m_data;
+  }
+}
+
+void CommandHistory::_open_index()
+{
+  if (m_index_opened || m_path.empty())
+  {
+    return;
+  }
+  m_index_opened = true;
+  int fd = ::open((m_path + ".index").c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) // not written yet
+  {
+    return;
+  }
+  struct stat index_status, log_status;
+  void *data = MAP_FAILED;
+  if (fstat(fd, &index_status) == 0 && fstat(m_fd, &log_status) == 0 &&
+      static_cast<size_t>(index_status.st_size) >= sizeof(IndexHeader))
+  {
+    data = mmap(nullptr, index_status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (data == MAP_FAILED)
+  {
+    return;
+  }
+  m_index_data = static_cast<const char *>(data);
+  m_index_size = index_status.st_size;
+
+  // an index of another log, or of a log that was cut since, is not used (and is written again later)
+  const IndexHeader *header = reinterpret_cast<const IndexHeader *>(m_index_data);
+  size_t expected_size = sizeof(IndexHeader) + header->entries * sizeof(uint64_t) +
+                         header->trigrams * sizeof(IndexTrigram) + header->postings * sizeof(uint32_t);
+  if (memcmp(header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 || expected_size != m_index_size ||
+      header->log_device != static_cast<uint64_t>(log_status.st_dev) ||
+      header->log_inode != static_cast<uint64_t>(log_status.st_ino) || header->log_size > m_size ||
+      (header->log_size > 0 && m_data[header->log_size - 1] != '\n'))
+  {
+    _close_index();
+    return;
+  }
+  m_index_entries = header->entries;
+  m_index_offsets = reinterpret_cast<const uint64_t *>(m_index_data + sizeof(IndexHeader));
+  m_index_trigrams = reinterpret_cast<const IndexTrigram *>(m_index_offsets + header->entries);
+  m_index_trigrams_count = header->trigrams;
+  m_index_postings = reinterpret_cast<const uint32_t *>(m_index_trigrams + header->trigrams);
+  // nothing of the log was scanned before
+  m_scanned_size = header->log_size;
+  m_indexed_entries = m_index_entries;
+}
+
+void CommandHistory::_close_index()
+{
+  if (m_index_data)
+  {
+    munmap(const_cast<char *>(m_index_data), m_index_size);
+  }
+  m_index_data = nullptr;
+  m_index_size = 0;
+  m_index_entries = 0;
+  m_index_offsets = nullptr;
+  m_index_trigrams = nullptr;
+  m_index_trigrams_count = 0;
+  m_index_postings = nullptr;
+}
+
+const char *CommandHistory::_entry_end(size_t index) const
+{
+  return m_data + ((index + 1 < _entries_count()) ? _entry_offset(index + 1) : m_scanned_size) - 1;
+}
+
+void CommandHistory::_index_trigrams()
+{
+  for (; m_indexed_entries < _entries_count(); ++m_indexed_entries)
+  {
+    const char *end = _entry_end(m_indexed_entries);
+    for (const char *c = _entry_begin(m_indexed_entries); c + 3 <= end; ++c)
+    {
+      std::vector<uint32_t> &entries = m_trigrams[_trigram(c)];
+      if (entries.empty() || entries.back() != m_indexed_entries) // once per entry
+      {
+        entries.push_back(m_indexed_entries);
+      }
+    }
+  }
+}
+
+const uint32_t *CommandHistory::_find_indexed(uint32_t trigram, size_t *count) const
+{
+  const IndexTrigram *end = m_index_trigrams + m_index_trigrams_count;
+  const IndexTrigram *found = std::lower_bound(m_index_trigrams, end, trigram,
+                                               [](const IndexTrigram &entry, uint32_t value)
+                                               { return entry.trigram < value; });
+  if (found == end || found->trigram != trigram)
+  {
+    *count = 0;
+    return nullptr;
+  }
+  *count = found->count;
+  return m_index_postings + found->first;
+}
+
+bool CommandHistory::_write_index()
+{
+  // a count for every possible trigram, calloc'ed so only the pages of the trigrams that occur are ever touched
+  // (they are walked through the list of the occupied ones, never all of them)
+  const size_t ALL_TRIGRAMS = 1 << 24;
+  uint32_t *counts = static_cast<uint32_t *>(calloc(ALL_TRIGRAMS, sizeof(uint32_t)));
+  uint32_t *last_entries = static_cast<uint32_t *>(calloc(ALL_TRIGRAMS, sizeof(uint32_t))); // + 1, once per entry
+  if (!counts || !last_entries)
+  {
+    _perror("smash error: history: calloc failed");
+    free(counts);
+    free(last_entries);
+    return false;
+  }
+
+  // the entries of every trigram: the ones in the index file, then the ones after it
+  std::vector<uint32_t> occupied;
+  occupied.reserve(m_index_trigrams_count);
+  for (size_t i = 0; i < m_index_trigrams_count; ++i)
+  {
+    counts[m_index_trigrams[i].trigram] = m_index_trigrams[i].count;
+    occupied.push_back(m_index_trigrams[i].trigram);
+  }
+  for (size_t entry = m_index_entries; entry < _entries_count(); ++entry)
+  {
+    const char *end = _entry_end(entry);
+    for (const char *c = _entry_begin(entry); c + 3 <= end; ++c)
+    {
+      uint32_t trigram = _trigram(c);
+      if (last_entries[trigram] != entry + 1)
+      {
+        last_entries[trigram] = entry + 1;
+        if (counts[trigram]++ == 0)
+        {
+          occupied.push_back(trigram);
+        }
+      }
+    }
+  }
+  std::sort(occupied.begin(), occupied.end()); // the file is searched by trigram
+  std::vector<IndexTrigram> trigrams;
+  trigrams.reserve(occupied.size());
+  uint64_t postings_count = 0;
+  for (uint32_t trigram : occupied)
+  {
+    IndexTrigram indexed = {trigram, counts[trigram], postings_count};
+    postings_count += counts[trigram];
+    counts[trigram] = trigrams.size(); // where it is from now on
+    trigrams.push_back(indexed);
+  }
+  free(last_entries);
+
+  // filled in the same order, so the entries of every trigram stay in ascending order
+  std::vector<uint32_t> postings(postings_count);
+  std::vector<uint64_t> next(trigrams.size());
+  for (size_t i = 0; i < trigrams.size(); ++i)
+  {
+    next[i] = trigrams[i].first;
+  }
+  for (size_t i = 0; i < m_index_trigrams_count; ++i)
+  {
+    const IndexTrigram &indexed = m_index_trigrams[i];
+    uint64_t &position = next[counts[indexed.trigram]];
+    memcpy(&postings[position], m_index_postings + indexed.first, indexed.count * sizeof(uint32_t));
+    position += indexed.count;
+  }
+  for (size_t entry = m_index_entries; entry < _entries_count(); ++entry)
+  {
+    const char *end = _entry_end(entry);
+    for (const char *c = _entry_begin(entry); c + 3 <= end; ++c)
+    {
+      size_t slot = counts[_trigram(c)];
+      if (next[slot] == trigrams[slot].first || postings[next[slot] - 1] != entry) // once per entry
+      {
+        postings[next[slot]++] = entry;
+      }
+    }
+  }
+  free(counts);
+
+  struct stat log_status;
+  if (fstat(m_fd, &log_status) == -1)
+  {
+    _perror("smash error: history: fstat failed");
+    return false;
+  }
+  IndexHeader header;
+  memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+  header.log_device = log_status.st_dev;
+  header.log_inode = log_status.st_ino;
+  header.log_size = m_scanned_size;
+  header.entries = _entries_count();
+  header.trigrams = trigrams.size();
+  header.postings = postings_count;
+  std::vector<uint64_t> offsets(m_entries.begin(), m_entries.end()); // of the entries after the index file
+
+  // a new file that replaces the old one at once, the other smash sessions may have the old one mapped
+  std::string path = m_path + ".index";
+  std::string temporary_path = path + "." + std::to_string(getpid());
+  FILE *file = fopen(temporary_path.c_str(), "we");
+  if (file == nullptr)
+  {
+    _perror("smash error: history: fopen failed");
+    return false;
+  }
+  fwrite(&header, sizeof(header), 1, file);
+  fwrite(m_index_offsets, sizeof(uint64_t), m_index_entries, file);
+  fwrite(offsets.data(), sizeof(uint64_t), offsets.size(), file);
+  fwrite(trigrams.data(), sizeof(IndexTrigram), trigrams.size(), file);
+  fwrite(postings.data(), sizeof(uint32_t), postings.size(), file);
+  if (ferror(file) | (fclose(file) == EOF) || rename(temporary_path.c_str(), path.c_str()) == -1)
+  {
+    _perror("smash error: history: writing the index failed");
+    unlink(temporary_path.c_str());
+    return false;
+  }
+
+  // the new file is used from now on (or the one of another session, if it replaced it meanwhile),
+  // only the entries after it are kept in memory
+  _close_index();
+  m_entries.clear();
+  std::unordered_map<uint32_t, std::vector<uint32_t>>().swap(m_trigrams);
+  m_scanned_size = m_indexed_entries = 0;
+  m_index_opened = false;
+  _open_index();
+  _scan();
+  return true;
+}
+
+void CommandHistory::_print_entry(size_t index) const
+{
+  std::cout << std::setw(5) << index + 1 << "  ";
+  std::cout.write(_entry_begin(index), _entry_end(index) - _entry_begin(index));
+  std::cout << "\n";
+}
+
+void CommandHistory::print()
+{
+  if (!_load())
+  {
+    return;
+  }
+  for (size_t i = 0; i < _entries_count(); ++i)
+  {
+    _print_entry(i);
+  }
+}
+
+// the entries of a trigram, and how many there are
+typedef std::pair<const uint32_t *, size_t> Postings;
+
+// the entries that are in all the lists (each one ascending), from the shortest list on
+static std::vector<uint32_t> _intersect_postings(std::vector<Postings> lists)
+{
+  std::sort(lists.begin(), lists.end(),
+            [](const Postings &first, const Postings &second) { return first.second < second.second; });
+  std::vector<uint32_t> entries(lists.front().first, lists.front().first + lists.front().second);
+  for (size_t i = 1; i < lists.size() && !entries.empty(); ++i)
+  {
+    const uint32_t *position = lists[i].first;
+    const uint32_t *end = lists[i].first + lists[i].second;
+    size_t kept = 0;
+    for (uint32_t entry : entries)
+    {
+      position = std::lower_bound(position, end, entry);
+      if (position != end && *position == entry)
+      {
+        entries[kept++] = entry;
+      }
+    }
+    entries.resize(kept);
+  }
+  return entries;
+}
+
+void CommandHistory::search(const std::string &text)
+{
+  if (!_load())
+  {
+    return;
+  }
+
+  // a short text has no trigrams, every entry is a candidate
+  if (text.size() < 3)
+  {
+    for (size_t i = 0; i < _entries_count(); ++i)
+    {
+      if (memmem(_entry_begin(i), _entry_end(i) - _entry_begin(i), text.data(), text.size()))
+      {
+        _print_entry(i);
+      }
+    }
+    return;
+  }
+
+  // many entries after the index file are indexed again in the file, a few in memory
+  size_t unsaved = m_entries.size();
+  if (!m_path.empty() && unsaved >= MIN_UNSAVED_ENTRIES && unsaved * UNSAVED_ENTRIES_RATIO >= m_index_entries)
+  {
+    _write_index();
+  }
+  _index_trigrams();
+
+  // the candidates are the entries that have all the trigrams of the text (in the index file, then in memory),
+  // each one is then checked as a whole
+  std::vector<Postings> indexed, added;
+  for (size_t i = 0; i + 3 <= text.size(); ++i)
+  {
+    uint32_t trigram = _trigram(&text[i]);
+    size_t count;
+    const uint32_t *entries = _find_indexed(trigram, &count);
+    indexed.push_back(Postings(entries, count));
+    std::unordered_map<uint32_t, std::vector<uint32_t>>::const_iterator found = m_trigrams.find(trigram);
+    added.push_back((found == m_trigrams.end()) ? Postings(nullptr, 0)
+                                                : Postings(found->second.data(), found->second.size()));
+  }
+  std::vector<uint32_t> candidates = _intersect_postings(indexed);
+  std::vector<uint32_t> added_candidates = _intersect_postings(added);
+  candidates.insert(candidates.end(), added_candidates.begin(), added_candidates.end());
+  for (uint32_t index : candidates)
+  {
+    if (memmem(_entry_begin(index), _entry_end(index) - _entry_begin(index), text.data(), text.size()))
+    {
+      _print_entry(index);
+    }
+  }
+}
+
+/* *
+ * The CommandPathCache class
+ */
+
+CommandPathCache::CommandPathCache()
+    : m_entries(),
+      m_path()
+{
+}
+
+bool CommandPathCache::resolve(const char *name, std::string *path)
+{
+  // a name with a slash is a path by itself, the PATH is not searched for it (and there is nothing to cache)
+  if (strchr(name, '/'))
   {
-    IN = 0,
-    OUT = 1,
-    ERR = 2
-  };
+    return false;
+  }
+
+  const char *current_path = getenv("PATH");
+  if (current_path == nullptr || m_path != current_path)
+  {
+    // the PATH changed, all the cached paths might be wrong
+    m_entries.clear();
+    m_path = current_path ? current_path : "";
+  }
+
+  std::unordered_map<std::string, Entry>::iterator cached = m_entries.find(name);
+  if (cached != m_entries.end())
+  {
+    ++cached->second.hits;
+    *path = cached->second.path;
+    return true;
+  }
+
+  // search the PATH directories in order, just like execvp (an empty directory means the working directory)
+  size_t start = 0;
+  while (start <= m_path.size())
+  {
+    size_t end = m_path.find(':', start);
+    if (end == std::string::npos)
+    {
+      end = m_path.size();
+    }
+    std::string directory = m_path.substr(start, end - start);
+    std::string candidate = (directory.empty() ? "." : directory) + "/" + name;
+
+    struct stat file_status;
+    if (stat(candidate.c_str(), &file_status) == 0 && S_ISREG(file_status.st_mode) && access(candidate.c_str(), X_OK) == 0)
+    {
+      // a relative directory depends on the working directory, so its results can't be cached
+      if (candidate[0] == '/')
+      {
+        Entry entry;
+        entry.path = candidate;
+        entry.hits = 1;
+        m_entries[name] = entry;
+      }
+      *path = candidate;
+      return true;
+    }
+    start = end + 1;
+  }
+  return false;
+}
+
+void CommandPathCache::forget(const char *name)
+{
+  m_entries.erase(name);
+}
+
+void CommandPathCache::clear()
+{
+  m_entries.clear();
+}
+
+void CommandPathCache::print() const
+{
+  if (m_entries.empty())
+  {
+    std::cout << "smash: hash: hash table empty\n";
+    return;
+  }
+  std::cout << "hits\tcommand\n";
+  for (std::unordered_map<std::string, Entry>::const_iterator it = m_entries.begin(); it != m_entries.end(); ++it)
+  {
+    std::cout << std::setw(4) << it->second.hits << "\t" << it->second.path << "\n";
+  }
+}
+
+/* *
+ * The TimeoutScheduler class
+ */
+
+TimeoutScheduler::TimeoutScheduler()
+    : m_heap(),
+      m_live(),
+      m_next_serial(0)
+{
+}
+
+void TimeoutScheduler::add(pid_t pid, unsigned int seconds, const std::string &cmd_line, bool group)
+{
+  Timeout timeout = {time(nullptr) + seconds, pid, group, m_next_serial++, cmd_line};
+  m_live[pid] = timeout.serial;
+  m_heap.push_back(timeout);
+  std::push_heap(m_heap.begin(), m_heap.end(), std::greater<Timeout>());
+  _arm();
+}
+
+void TimeoutScheduler::remove(pid_t pid)
+{
+  if (m_live.erase(pid) == 0) // not timed, the common case
+  {
+    return;
+  }
+  // the heap is rebuilt only once most of it was removed, so that costs O(1) per removal too
+  if (m_heap.size() > 2 * m_live.size() + 16)
+  {
+    m_heap.erase(std::remove_if(m_heap.begin(), m_heap.end(),
+                                [this](const Timeout &timeout) { return !_is_live(timeout); }),
+                 m_heap.end());
+    std::make_heap(m_heap.begin(), m_heap.end(), std::greater<Timeout>());
+  }
+  // no alarm for a deadline that is gone
+  if (!m_heap.empty() && !_is_live(m_heap.front()))
+  {
+    _drop_removed();
+    _arm();
+  }
+}
+
+void TimeoutScheduler::clear()
+{
+  m_heap.clear();
+  m_live.clear();
+  alarm(0);
+}
+
+bool TimeoutScheduler::_is_live(const Timeout &timeout) const
+{
+  std::unordered_map<pid_t, unsigned long>::const_iterator live = m_live.find(timeout.pid);
+  return live != m_live.end() && live->second == timeout.serial;
+}
+
+void TimeoutScheduler::_drop_removed()
+{
+  while (!m_heap.empty() && !_is_live(m_heap.front()))
+  {
+    std::pop_heap(m_heap.begin(), m_heap.end(), std::greater<Timeout>());
+    m_heap.pop_back();
+  }
+}
+
+void TimeoutScheduler::poll()
+{
+  if (takeAlarmNotifications())
+  {
+    std::cout << "smash: got an alarm\n";
+    expire();
+  }
+}
+
+void TimeoutScheduler::expire()
+{
+  time_t now = time(nullptr);
+  _drop_removed();
+  while (!m_heap.empty() && m_heap.front().deadline <= now)
+  {
+    std::pop_heap(m_heap.begin(), m_heap.end(), std::greater<Timeout>());
+    Timeout timeout = m_heap.back();
+    m_heap.pop_back();
+    m_live.erase(timeout.pid);
+    _drop_removed();
+
+    // only a command that is still running is killed (and not one that finished and was not reaped yet)
+    siginfo_t info;
+    info.si_pid = 0;
+    if (waitid(P_PID, timeout.pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0 && info.si_pid == 0 &&
+        kill(timeout.group ? -timeout.pid : timeout.pid, SIGKILL) == 0)
+    {
+      std::cout << "smash: " << timeout.cmd_line << " timed out!\n";
+    }
+  }
+  _arm();
+  // the smash may be waiting for the next line, the messages should not wait for it in the buffer
+  std::cout.flush();
+}
 
-  // create the pipe
-  int files[] = {-1, -1};
-  if (pipe(files) == -1)
+void TimeoutScheduler::_arm() const
+{
+  if (m_heap.empty())
   {
-    perror("smash error: pipe failed");
+    alarm(0);
     return;
   }
+  time_t left = m_heap.front().deadline - time(nullptr);
+  alarm((left > 0) ? left : 1); // alarm(0) would cancel it
+}
+
+/* *
+ * The ResourceUsage struct
+ */
+
+ResourceUsage::ResourceUsage()
+    : user_seconds(0),
+      system_seconds(0),
+      max_rss(0),
+      context_switches(0)
+{
+}
+
+void ResourceUsage::add(const struct rusage &usage)
+{
+  user_seconds += usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6;
+  system_seconds += usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+  max_rss = std::max(max_rss, usage.ru_maxrss);
+  context_switches += usage.ru_nvcsw + usage.ru_nivcsw;
+}
 
-  // change the write file from stdout/err
-  int original_write = -1;
-  if (m_pipe_type == PipeType::Standard) // we have to close/dup 1
+void ResourceUsage::add(const ResourceUsage &usage)
+{
+  user_seconds += usage.user_seconds;
+  system_seconds += usage.system_seconds;
+  max_rss = std::max(max_rss, usage.max_rss);
+  context_switches += usage.context_switches;
+}
+
+// the process group of a process (field 5 of its stat, see proc(5)), -1 if it's gone
+static pid_t _proc_group(pid_t pid)
+{
+  char buffer[4096];
+  pid_t group;
+  const char *fields = _read_proc_file(pid, "stat", buffer, sizeof(buffer)) ? strrchr(buffer, ')') : nullptr;
+  return (fields && sscanf(fields + 1, " %*c %*d %d", &group) == 1) ? group : -1;
+}
+
+void ResourceUsage::readGroups(std::unordered_map<pid_t, ResourceUsage> *groups)
+{
+  if (groups->empty())
+  {
+    return;
+  }
+  // the members of a group are only known to the kernel, so all the processes are checked (in one pass)
+  DIR *proc = opendir("/proc");
+  if (proc == nullptr)
+  {
+    _perror("smash error: opendir failed");
+    return;
+  }
+  struct dirent *entry;
+  while ((entry = readdir(proc)) != nullptr)
   {
-    original_write = dup(STANDARD::OUT); // stdout
-    if (original_write == -1)
+    if (!isdigit(entry->d_name[0]))
     {
-      perror("smash error: dup failed");
-      return;
+      continue;
     }
-    if (dup2(files[PIPE::WRITE], STANDARD::OUT))
+    pid_t pid = atoi(entry->d_name);
+    std::unordered_map<pid_t, ResourceUsage>::iterator group = groups->find(_proc_group(pid));
+    ResourceUsage usage;
+    if (group != groups->end() && usage.read(pid)) // may be gone meanwhile
     {
-      perror("smash error: dup2 failed");
-      return;
+      group->second.add(usage);
     }
   }
-  else // close/dup 2
+  closedir(proc);
+}
+
+bool ResourceUsage::read(pid_t pid)
+{
+  char buffer[4096];
+  // the fields after the command name (which may contain anything, even parentheses), from the state (field 3)
+  // to stime (field 15), see proc(5)
+  unsigned long user_ticks, system_ticks;
+  const char *fields = _read_proc_file(pid, "stat", buffer, sizeof(buffer)) ? strrchr(buffer, ')') : nullptr;
+  if (fields == nullptr ||
+      sscanf(fields + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &user_ticks, &system_ticks) != 2)
+  {
+    return false;
+  }
+  long ticks_per_second = sysconf(_SC_CLK_TCK);
+  user_seconds = static_cast<double>(user_ticks) / ticks_per_second;
+  system_seconds = static_cast<double>(system_ticks) / ticks_per_second;
+
+  max_rss = context_switches = 0;
+  if (_read_proc_file(pid, "status", buffer, sizeof(buffer)))
   {
-    original_write = dup(STANDARD::ERR); // stderr
-    if (original_write == -1)
+    long voluntary = 0, involuntary = 0;
+    const char *line;
+    if ((line = strstr(buffer, "\nVmHWM:")) != nullptr)
     {
-      perror("smash error: dup failed");
-      return;
+      sscanf(line, "\nVmHWM: %ld", &max_rss);
     }
-    if (dup2(files[PIPE::WRITE], STANDARD::ERR))
+    if ((line = strstr(buffer, "\nvoluntary_ctxt_switches:")) != nullptr)
     {
-      perror("smash error: dup2 failed");
-      return;
+      sscanf(line, "\nvoluntary_ctxt_switches: %ld", &voluntary);
+    }
+    if ((line = strstr(buffer, "\nnonvoluntary_ctxt_switches:")) != nullptr)
+    {
+      sscanf(line, "\nnonvoluntary_ctxt_switches: %ld", &involuntary);
     }
+    context_switches = voluntary + involuntary;
+  }
+  return true;
+}
+
+void ResourceUsage::print(double wall_seconds) const
+{
+  // not through the manipulators of std::cout, which would stay set for the next commands
+  char line[256];
+  snprintf(line, sizeof(line), "real %.3fs, user %.3fs, sys %.3fs, max rss %ld KiB, %ld context switches",
+           wall_seconds, user_seconds, system_seconds, max_rss, context_switches);
+  std::cout << line;
+}
+
+/* *
+ * The JobsList class
+ */
+
+/* The JobEntry class methods */
+JobsList::JobEntry::JobEntry(Command *command, pid_t job_pid, unsigned int job_id, State state, int pidfd,
+                             unsigned int processes)
+    : m_command(command),
+      m_job_pid(job_pid),
+      m_group(job_pid),
+      m_processes(processes),
+      m_pidfd(pidfd),
+      m_job_id(job_id),
+      m_state(state),
+      m_insertion_time(time(nullptr)),
+      m_state_change_time(m_insertion_time),
+      m_status(-1),
+      m_usage(),
+      m_end_time(0)
+{
+}
+
+Command *JobsList::JobEntry::getCommand()
+{
+  return m_command;
+}
+
+pid_t JobsList::JobEntry::getJobPid()
+{
+  return m_job_pid;
+}
+
+unsigned int JobsList::JobEntry::getJobID()
+{
+  return m_job_id;
+}
+
+void JobsList::JobEntry::setState(State state)
+{
+  if (m_state != state)
+  {
+    m_state = state;
+    m_state_change_time = time(nullptr);
+  }
+}
+
+bool JobsList::JobEntry::processExited(int status, const struct rusage *usage)
+{
+  m_status = status;
+  if (usage)
+  {
+    m_usage.add(*usage);
+  }
+  if (m_processes > 0)
+  {
+    --m_processes;
+  }
+  if (m_processes > 0)
+  {
+    return false;
   }
+  m_end_time = _monotonic_seconds();
+  return true;
+}
+
+double JobsList::JobEntry::getWallSeconds() const
+{
+  return ((m_end_time != 0) ? m_end_time : _monotonic_seconds()) - m_command->getStartTime();
+}
+
+/* The JobList class methods */
+unsigned int JobsList::size() const
+{
+  return m_count;
+}
 
-  // execute the first command
-  m_cmd_1->execute();
+const JobsList::JobEntry EMPTY_JOB_SLOT(nullptr, -1, 0, JobsList::JobEntry::State::Done);
 
-  // return back the original write stream
-  if (dup2(original_write, files[PIPE::WRITE]))
+JobsList::JobsList()
+    : m_slots(1, EMPTY_JOB_SLOT), // the ids start from 1, slot 0 is never used
+      m_ids_by_pid(),
+      m_stopped_ids(),
+      m_count(0),
+      m_kept_statuses(),
+      m_exits(epoll_create1(EPOLL_CLOEXEC)),
+      m_finished()
+{
+  if (m_exits == -1)
   {
-    perror("smash error: dup2 failed");
-    return;
+    _perror("smash error: epoll_create1 failed");
+  }
+}
+
+JobsList::~JobsList()
+{
+  for (JobEntry &job : m_slots)
+  {
+    _release(job);
+  }
+  if (m_exits != -1)
+  {
+    close(m_exits);
   }
+}
 
-  // change the read file from stdin
-  int original_read = dup(STANDARD::IN); // stdin
-  if (original_read == -1)
+bool JobsList::_is_used(unsigned int jobId) const
+{
+  return jobId < m_slots.size() && !m_slots[jobId].isEmpty();
+}
+
+// assumes a valid command
+void JobsList::addJob(Command *cmd, pid_t pid, JobEntry::State state, unsigned int jobId, unsigned int processes)
+{
+  // the new job id depends on the jobs that are still in the list
+  removeFinishedJobs();
+  if (cmd)
   {
-    perror("smash error: dup failed");
-    return;
+    // the maximal job id + 1 (or 1 if the list is empty), since there are no empty slots at the end
+    unsigned int job_id = (jobId > 0 && !_is_used(jobId)) ? jobId : m_slots.size();
+    if (job_id >= m_slots.size())
+    {
+      m_slots.resize(job_id + 1, EMPTY_JOB_SLOT);
+    }
+    // the exit of the job is reported by its pidfd (without it, by the sweep in removeFinishedJobs).
+    // the pidfd is opened after the sweep above: a child that it reaped already has its exit kept, and its pid
+    // may belong to another process by now, so it gets no pidfd (see takeUnclaimedExit)
+    int pidfd = (m_unclaimed.count(pid) == 0) ? _open_pidfd(pid) : -1;
+    struct epoll_event exit_event = {};
+    exit_event.events = EPOLLIN;
+    exit_event.data.u64 = pid;
+    if (pidfd != -1 && m_exits != -1 && epoll_ctl(m_exits, EPOLL_CTL_ADD, pidfd, &exit_event) == -1)
+    {
+      _perror("smash error: epoll_ctl failed");
+    }
+    m_slots[job_id] = JobEntry(cmd, pid, job_id, state, pidfd, processes);
+    cmd->setJob(true); // owned by the list from now on
+    cmd->markStarted();
+    m_ids_by_pid[pid] = job_id;
+    if (state == JobEntry::State::Stopped)
+    {
+      m_stopped_ids.insert(job_id);
+    }
+    ++m_count;
+    // its processes that exited before it was added are claimed by the next removeFinishedJobs (its command is
+    // still used by the caller)
+  }
+}
+
+pid_t JobsList::takeUnclaimedExit(pid_t group, int *status, struct rusage *usage)
+{
+  // only the children that exited in the short time before they were claimed are here
+  for (std::unordered_map<pid_t, UnclaimedExit>::iterator it = m_unclaimed.begin(); it != m_unclaimed.end(); ++it)
+  {
+    if (it->second.group == group)
+    {
+      pid_t pid = it->first;
+      *status = it->second.status;
+      *usage = it->second.usage;
+      m_unclaimed.erase(it);
+      return pid;
+    }
   }
-  if (dup2(files[PIPE::READ], STANDARD::IN))
+  return 0;
+}
+
+void JobsList::setJobState(int jobId, JobEntry::State state)
+{
+  JobEntry *job = getJobById(jobId);
+  if (!job)
   {
-    perror("smash error: dup2 failed");
     return;
   }
+  job->setState(state);
+  if (state == JobEntry::State::Stopped)
+  {
+    m_stopped_ids.insert(jobId);
+  }
+  else
+  {
+    m_stopped_ids.erase(jobId);
+  }
+}
+
+void JobsList::printJobsList(bool verbose)
+{
+  // a running job is only reaped by wait4 at the end, until then the usage of its processes is read from /proc
+  // (and added to the usage of its processes that were reaped already, the first stages of a pipeline)
+  std::unordered_map<pid_t, ResourceUsage> usages;
+  for (size_t id = 1; verbose && id < m_slots.size(); ++id)
+  {
+    if (_is_used(id))
+    {
+      usages[m_slots[id].getGroup()] = m_slots[id].getUsage();
+    }
+  }
+  ResourceUsage::readGroups(&usages);
 
-  // execute the second command
-  m_cmd_2->execute();
+  for (size_t id = 1; id < m_slots.size(); ++id)
+  {
+    if (!_is_used(id))
+    {
+      continue;
+    }
+    JobEntry &job = m_slots[id];
+    if (!verbose)
+    {
+      std::cout << "[" << id << "] " << job.getCommand()->getJobCMDLine()
+                << ((job.getState() == JobEntry::State::Stopped) ? " (stopped)" : "") << "\n";
+      continue;
+    }
+    const ResourceUsage &usage = usages[job.getGroup()];
+    std::cout << "[" << id << "] " << job.getCommand()->getJobCMDLine()
+              << ((job.getState() == JobEntry::State::Stopped) ? " (stopped): " : " (running): ");
+    usage.print(job.getWallSeconds());
+    std::cout << "\n";
+  }
 
-  // return back the original read stream
-  if (dup2(original_read, files[PIPE::READ]))
+  if (!verbose)
   {
-    perror("smash error: dup2 failed");
     return;
   }
+  for (std::deque<FinishedJob>::const_iterator it = m_finished.begin(); it != m_finished.end(); ++it)
+  {
+    std::cout << "[" << it->job_id << "] " << it->cmd_line;
+    if (WIFSIGNALED(it->status))
+    {
+      std::cout << " (killed by signal " << WTERMSIG(it->status) << "): ";
+    }
+    else
+    {
+      std::cout << " (exited with status " << WEXITSTATUS(it->status) << "): ";
+    }
+    it->usage.print(it->wall_seconds);
+    std::cout << "\n";
+  }
 }
 
-// * Special Commands 3 (ChmodCommand) , actually inherits from BuiltInCommand
+void JobsList::killAllJobs()
+{
+  std::cout << "smash: sending SIGKILL signal to " << size() << " jobs:\n";
+  for (size_t id = 1; id < m_slots.size(); ++id)
+  {
+    if (!_is_used(id))
+    {
+      continue;
+    }
+    JobEntry &job = m_slots[id];
+    std::cout << job.getJobPid() << ": " << job.getCommand()->getJobCMDLine() << "\n";
+    if (!sendSignal(id, SIGKILL, job.getProcesses() > 1)) // failure, all the stages of a pipeline
+    {
+      _perror("smash error: kill failed");
+    }
+    _release(job);
+  }
+  m_slots.resize(1, EMPTY_JOB_SLOT);
+  m_ids_by_pid.clear();
+  m_stopped_ids.clear();
+  m_count = 0;
+}
 
-ChmodCommand::ChmodCommand(const char *cmd_line)
-    : BuiltInCommand(cmd_line)
+void JobsList::removeFinishedJobs()
 {
-  if (getName() != "chmod")
+  TRACE_SCOPE("reap");
+  // the processes of jobs that were reaped before they were added as jobs
+  for (std::unordered_map<pid_t, UnclaimedExit>::iterator it = m_unclaimed.begin(); it != m_unclaimed.end();)
   {
-    throw std::logic_error("ChmodCommand::ChmodCommand");
+    JobEntry *job = getJobByPid(it->second.group);
+    if (!job)
+    {
+      ++it;
+      continue;
+    }
+    pid_t pid = it->first;
+    UnclaimedExit unclaimed = it->second;
+    it = m_unclaimed.erase(it);
+    _update_job(job, pid, unclaimed.status, &unclaimed.usage);
   }
 
-  if (getArgs().size() != 2)
+  // the jobs that exited, straight from their pidfds (nothing is asked about the ones that are still running)
+  const int MAX_EVENTS = 64;
+  struct epoll_event events[MAX_EVENTS];
+  int ready = MAX_EVENTS;
+  while (m_exits != -1 && ready == MAX_EVENTS && (ready = epoll_wait(m_exits, events, MAX_EVENTS, 0)) > 0)
   {
-    std::cerr << "smash error: chmod: invalid arguments\n";
-    throw std::logic_error("ChmodCommand::ChmodCommand");
+    for (int i = 0; i < ready; ++i)
+    {
+      _reap(static_cast<pid_t>(events[i].data.u64));
+    }
+  }
+
+  // O(1) when no child has changed its state since the last time
+  if (!takeChildNotifications())
+  {
+    return;
   }
 
-  std::string modes = getArgs().front();
-  std::string file_path = getArgs().back();
-
-  // if the string is NOT from 3 octal digits
-  if ((modes.size() != 3) || (modes.find_first_not_of("01234567") != std::string::npos))
+  // the stopped and continued jobs (without WEXITED, waitid doesn't reap anything)
+  siginfo_t info;
+  while ((info.si_pid = 0, waitid(P_ALL, 0, &info, WSTOPPED | WCONTINUED | WNOHANG)) == 0 && info.si_pid != 0)
   {
-    std::cerr << "smash error: chmod: invalid arguments\n";
-    throw std::logic_error("ChmodCommand::ChmodCommand");
+    JobEntry *job = _find_job(info.si_pid);
+    if (job)
+    {
+      setJobState(job->getJobID(), (info.si_code == CLD_STOPPED) ? JobEntry::State::Stopped : JobEntry::State::Running);
+    }
+  }
+  // the children that exited without a pidfd: the other stages of background pipelines, jobs on old kernels
+  while ((info.si_pid = 0, waitid(P_ALL, 0, &info, WEXITED | WNOHANG | WNOWAIT)) == 0 && info.si_pid != 0)
+  {
+    _reap(info.si_pid);
   }
 }
 
-ChmodCommand::~ChmodCommand()
+JobsList::JobEntry *JobsList::_find_job(pid_t pid)
 {
-  // default
+  JobEntry *job = getJobByPid(pid);
+  if (job)
+  {
+    return job;
+  }
+  // the other stages of a pipeline, the process group is known until the process is reaped (even as a zombie)
+  pid_t group = getpgid(pid);
+  job = (group != -1) ? getJobByPid(group) : nullptr;
+  return (job && job->getGroup() == group) ? job : nullptr;
 }
 
-void ChmodCommand::execute()
+void JobsList::_reap(pid_t pid)
 {
-  mode_t mode = static_cast<mode_t>(std::stoi(getArgs().front(), nullptr, 8)); // shouldn't throw
-
-  if (chmod(getArgs().back().c_str(), mode) == -1) // getArgs().back() is the file path
+  JobEntry *job = _find_job(pid);
+  // a child that is not a job yet (added right after it was launched, or waited for in the foreground)
+  pid_t group = (job || m_kept_statuses.count(pid) != 0) ? 0 : getpgid(pid);
+  int status;
+  struct rusage usage;
+  pid_t result = wait4(pid, &status, WNOHANG, &usage);
+  if (result == pid && group > 0 && (WIFEXITED(status) || WIFSIGNALED(status)))
+  {
+    UnclaimedExit unclaimed = {group, status, usage};
+    m_unclaimed[pid] = unclaimed;
+  }
+  else if (result == pid)
+  {
+    _update_job(job, pid, status, &usage);
+  }
+  else if (result == -1 && job && job->getJobPid() == pid) // already reaped by someone else, the job is gone anyway
   {
-    perror("smash error: chmod failed");
+    removeJobById(job->getJobID());
   }
 }
 
-/*
- * Built In Commands
- */
-
-BuiltInCommand::BuiltInCommand(const char *cmd_line)
-    : Command(cmd_line),
-      m_name(m_parse_name(cmd_line)),
-      m_args(m_parse_args(cmd_line))
+void JobsList::_close_pidfd(JobEntry &job)
 {
+  if (job.getPidfd() == -1)
+  {
+    return;
+  }
+  // the epoll set refers to the open file, which stays open as long as any process has a copy of the descriptor
+  if (m_exits != -1 && epoll_ctl(m_exits, EPOLL_CTL_DEL, job.getPidfd(), nullptr) == -1)
+  {
+    _perror("smash error: epoll_ctl failed");
+  }
+  close(job.getPidfd());
+  job.setPidfd(-1);
 }
 
-BuiltInCommand::~BuiltInCommand()
+void JobsList::closeDescriptors()
 {
-  // default
+  // no EPOLL_CTL_DEL, the epoll set is shared with the smash, and its registrations are kept by its own pidfds
+  for (JobEntry &job : m_slots)
+  {
+    if (job.getPidfd() != -1)
+    {
+      close(job.getPidfd());
+      job.setPidfd(-1);
+    }
+  }
+  if (m_exits != -1)
+  {
+    close(m_exits);
+    m_exits = -1;
+  }
 }
 
-std::string BuiltInCommand::m_parse_name(const char *cmd_line) const
+void JobsList::_release(JobEntry &job, bool keep_command)
 {
-  std::istringstream iss(_trim(string(cmd_line)).c_str());
-
-  // if there is no first string then an empty string has been given (shouldn't be tested)
-  std::string cmd_name;
-  if (!(iss >> cmd_name))
+  _close_pidfd(job);
+  if (job.getCommand())
   {
-    // ? should not throw i think but lets keep it in case of debugging
-    throw std::logic_error("MY_ERROR: BuiltInCommand::m_parse_name.");
+    job.getCommand()->setJob(false);
+    if (!keep_command)
+    {
+      delete job.getCommand();
+    }
   }
-  return cmd_name;
 }
 
-std::vector<std::string> BuiltInCommand::m_parse_args(const char *cmd_line) const
+bool JobsList::sendSignal(int jobId, int signal, bool group)
 {
-  std::vector<std::string> args;
-  std::istringstream iss(_trim(string(cmd_line)).c_str());
-
-  // ignore the first string
-  std::string cmd_name;
-  if (!(iss >> cmd_name))
+  JobEntry *job = getJobById(jobId);
+  if (!job)
   {
-    // ? should not throw i think but lets keep it in case of debugging
-    throw std::logic_error("MY_ERROR: BuiltInCommand::m_parse_args.");
+    errno = ESRCH;
+    return false;
   }
-
-  // push the other strings
-  for (std::string s; iss >> s;)
+  if (job->getPidfd() != -1 && _pidfd_send_signal(job->getPidfd(), group ? 0 : signal) == -1)
   {
-    args.push_back(s);
+    return false; // with group, the signal 0 only checks that the job is still the same process
   }
-  return args;
+  if (job->getPidfd() != -1 && !group)
+  {
+    return true;
+  }
+  if (kill(group ? -job->getGroup() : job->getJobPid(), signal) == 0)
+  {
+    return true;
+  }
+  // the first process of a pipeline may be gone while the other stages are still running
+  return !group && errno == ESRCH && job->getPidfd() == -1 && kill(-job->getGroup(), signal) == 0;
 }
 
-// * BuiltInCommand 1 (ChangePromptCommand)
+void JobsList::updateJob(pid_t pid, int status, const struct rusage *usage)
+{
+  _update_job(getJobByPid(pid), pid, status, usage);
+}
 
-ChangePromptCommand::ChangePromptCommand(const char *cmd_line)
-    : BuiltInCommand(cmd_line)
+void JobsList::_update_job(JobEntry *job, pid_t pid, int status, const struct rusage *usage)
 {
-  if (getName() != "chprompt")
+  std::unordered_map<pid_t, int>::iterator kept = m_kept_statuses.find(pid);
+  if (kept != m_kept_statuses.end() && (WIFEXITED(status) || WIFSIGNALED(status)))
   {
-    throw std::logic_error("ChangePromptCommand::ChangePromptCommand");
+    kept->second = status;
+  }
+  if (usage && (WIFEXITED(status) || WIFSIGNALED(status)))
+  {
+    SmallShell::getInstance().reportTimedChild(pid, *usage);
   }
-}
 
-ChangePromptCommand::~ChangePromptCommand()
-{
-  // default
+  if (!job)
+  {
+    return;
+  }
+  if (WIFSTOPPED(status))
+  {
+    setJobState(job->getJobID(), JobEntry::State::Stopped);
+  }
+  else if (WIFCONTINUED(status))
+  {
+    setJobState(job->getJobID(), JobEntry::State::Running);
+  }
+  else if (!job->processExited(status, usage)) // the other stages are still running
+  {
+    if (pid == job->getJobPid())
+    {
+      _close_pidfd(*job); // readable from now on, and the signals go to the group
+    }
+  }
+  else // all of its processes exited or were killed
+  {
+    job->setState(JobEntry::State::Done);
+    SmallShell::getInstance().getTimeouts().remove(job->getJobPid()); // its pid may be reused
+    FinishedJob finished = {job->getJobID(), job->getCommand()->getJobCMDLine(), status, job->getWallSeconds(),
+                            job->getUsage()};
+    m_finished.push_back(finished);
+    if (m_finished.size() > MAX_FINISHED)
+    {
+      m_finished.pop_front();
+    }
+    removeJobById(job->getJobID());
+  }
 }
 
-void ChangePromptCommand::execute()
+void JobsList::keepExitStatus(pid_t pid)
 {
-  // ? Any special checking for the name validity
-  SmallShell::getInstance().setPrompt(
-      (getArgs().size() == 0) ? SmallShell::DEFAULT_PROMPT : getArgs().front());
+  m_kept_statuses[pid] = -1;
 }
 
-// * BuiltInCommand 2 (ShowPidCommand)
-ShowPidCommand::ShowPidCommand(const char *cmd_line)
-    : BuiltInCommand(cmd_line)
+bool JobsList::takeExitStatus(pid_t pid, int *status)
 {
-  if (getName() != "showpid")
+  std::unordered_map<pid_t, int>::iterator kept = m_kept_statuses.find(pid);
+  if (kept == m_kept_statuses.end() || kept->second == -1)
   {
-    throw std::logic_error("ShowPidCommand::ShowPidCommand");
+    return false;
   }
+  *status = kept->second;
+  m_kept_statuses.erase(kept);
+  return true;
 }
 
-ShowPidCommand::~ShowPidCommand()
+void JobsList::forgetExitStatus(pid_t pid)
 {
-  // default
+  m_kept_statuses.erase(pid);
 }
 
-void ShowPidCommand::execute()
+JobsList::JobEntry *JobsList::getJobById(int jobId)
 {
-  // `getpid()` is always successful and does not have an error return.
-  std::cout << "smash pid is " << getpid() << '\n';
+  return (jobId > 0 && _is_used(jobId)) ? &m_slots[jobId] : nullptr;
 }
 
-// * BuiltInCommand 3 (GetCurrDirCommand)
-GetCurrDirCommand::GetCurrDirCommand(const char *cmd_line)
-    : BuiltInCommand(cmd_line)
+JobsList::JobEntry *JobsList::getJobByPid(pid_t pid)
 {
-  if (getName() != "pwd")
-  {
-    throw std::logic_error("GetCurrDirCommand::GetCurrDirCommand");
-  }
+  std::unordered_map<pid_t, unsigned int>::const_iterator found = m_ids_by_pid.find(pid);
+  return (found != m_ids_by_pid.end()) ? &m_slots[found->second] : nullptr;
 }
 
-GetCurrDirCommand::~GetCurrDirCommand()
+void JobsList::removeJobById(int jobId)
 {
-  // default
+  Command::release(takeJob(jobId));
 }
 
-void GetCurrDirCommand::execute()
+Command *JobsList::takeJob(int jobId)
 {
-  char path[COMMAND_MAX_PATH_LENGTH + 1];
-  // `getcwd()` writes the absolute pathname of the current working directory to the `path` array
-  if (getcwd(path, COMMAND_MAX_PATH_LENGTH + 1) != nullptr) // success
+  if (jobId <= 0 || !_is_used(jobId))
   {
-    std::cout << std::string(path) << '\n';
+    return nullptr;
   }
-  else
+  Command *command = m_slots[jobId].getCommand();
+  m_ids_by_pid.erase(m_slots[jobId].getJobPid());
+  m_stopped_ids.erase(jobId);
+  _release(m_slots[jobId], true);
+  m_slots[jobId] = EMPTY_JOB_SLOT;
+  --m_count;
+
+  // keep the last slot used, so the next id is simply the number of slots (amortized O(1))
+  while (m_slots.size() > 1 && m_slots.back().isEmpty())
   {
-    // ? should we print an error
-    perror("smash error: getcwd failed");
+    m_slots.pop_back();
   }
+  return command;
 }
 
-// * BuiltInCommand 4 (ChangeDirCommand)
-
-/* static variables */
-std::list<std::string> ChangeDirCommand::CD_PATH_HISTORY; // default c'tor will be called
+JobsList::JobEntry *JobsList::getLastJob(int *lastJobId)
+{
+  if (size() == 0)
+  {
+    return nullptr;
+  }
+  if (lastJobId)
+  {
+    *lastJobId = m_slots.back().getJobID();
+  }
+  return &m_slots.back();
+}
 
-ChangeDirCommand::ChangeDirCommand(const char *cmd_line)
-    : BuiltInCommand(cmd_line)
+JobsList::JobEntry *JobsList::getLastStoppedJob(int *jobId)
 {
-  if (getName() != "cd")
+  if (m_stopped_ids.empty())
   {
-    throw std::logic_error("ChangeDirCommand::ChangeDirCommand");
+    return nullptr;
   }
-  // 0 arguments will NOT be tested
-  if (getArgs().size() > 1) // more than one argument
+  unsigned int last_stopped_id = *m_stopped_ids.rbegin();
+  if (jobId)
   {
-    std::cerr << "smash error: cd: too many arguments\n";
-    invalidate_command();
+    *jobId = last_stopped_id;
   }
+  return &m_slots[last_stopped_id];
 }
 
-ChangeDirCommand::~ChangeDirCommand()
+/* *
+ * The CommandPlan class
+ */
+
+CommandPlan::Step::Step(unsigned int line_number, const std::string &cmd_line)
+    : line_number(line_number),
+      cmd_line(cmd_line),
+      tokens(cmd_line.c_str()),
+      factory(SmallShell::getInstance().ClassifyCommand(cmd_line.c_str(), tokens))
 {
-  // default
 }
 
-void ChangeDirCommand::execute()
+CommandPlan::CommandPlan()
+    : m_steps(),
+      m_file_status()
 {
-  // 0 arguments for cd will NOT be tested
+}
 
-  // get the current working directory
-  char cwd[COMMAND_MAX_PATH_LENGTH+1];
-  // `getcwd()` writes the absolute pathname of the current working directory to the `path` array
-  if (getcwd(cwd, COMMAND_MAX_PATH_LENGTH+1) == nullptr) // failure
+bool CommandPlan::load(const std::string &path)
+{
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
   {
-    perror("smash error: getcwd failed");
-    return;
+    _perror("smash error: open failed");
+    return false;
+  }
+  struct stat file_status;
+  if (fstat(fd, &file_status) == -1)
+  {
+    _perror("smash error: fstat failed");
+    close(fd);
+    return false;
   }
-  std::string curr_dir(cwd);
 
-  // the ctor guarantees there will be 1 argument only
-  if ("-" == getArgs().back())
+  // an empty file can't be mapped (and has nothing to run anyway)
+  const char *script = nullptr;
+  if (file_status.st_size > 0)
   {
-    if (CD_PATH_HISTORY.size() == 0)
-    {
-      std::cerr << "smash error: cd: OLDPWD not set\n";
-      return;
-    }
-    else
+    void *mapped = mmap(nullptr, file_status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED)
     {
-      // CD_PATH_HISTORY has paths in it
-      if (0 == chdir(CD_PATH_HISTORY.back().c_str())) // success
-      {
-        CD_PATH_HISTORY.pop_back();
-        CD_PATH_HISTORY.push_back(curr_dir);
-      }
-      else
-      {
-        perror("smash error: chdir failed");
-        return;
-      }
+      _perror("smash error: mmap failed");
+      close(fd);
+      return false;
     }
+    script = static_cast<const char *>(mapped);
   }
-  else if (".." == getArgs().back())
+  close(fd); // the mapping stays valid after the fd is closed
+
+  std::vector<Step> steps;
+  bool valid = true;
+  const char *line = script;
+  const char *script_end = script + file_status.st_size;
+  for (unsigned int line_number = 1; line < script_end; ++line_number)
   {
-    // get the parent directory
-    std::string parent_dir = get_parent_directory(cwd);
-    // change dir to the parent
-    if (0 == chdir(parent_dir.c_str())) // success
-    {
-      CD_PATH_HISTORY.push_back(curr_dir);
-    }
-    else
+    const char *line_end = static_cast<const char *>(memchr(line, '\n', script_end - line));
+    if (line_end == nullptr)
     {
-      perror("smash error: chdir failed");
+      line_end = script_end; // last line without a '\n'
     }
-  }
-  else // "normal path"
-  {
-    // change dir to the path given
-    if (0 == chdir(getArgs().front().c_str())) // success
+    std::string cmd_line(line, line_end);
+    line = line_end + 1;
+
+    std::string error;
+    if (!_check_syntax(cmd_line.c_str(), &error))
     {
-      CD_PATH_HISTORY.push_back(getArgs().front());
+      // keep going, so all the errors of the script are reported at once
+      std::cerr << "smash error: " << path << ":" << line_number << ": " << error << "\n";
+      valid = false;
+      continue;
     }
-    else
+    steps.push_back(Step(line_number, cmd_line));
+    if (steps.back().factory == nullptr) // empty line
     {
-      perror("smash error: chdir failed");
+      steps.pop_back();
     }
   }
-}
-
-/* methods */
-std::string ChangeDirCommand::get_parent_directory(const std::string &path) const
-{
-  size_t lastSlashPos = path.find_last_of("/");
 
-  // If there's no slash, or only one at the beginning (root), return as is or some indication
-  if (lastSlashPos == std::string::npos || (lastSlashPos == 0 && path.length() == 1))
-  {
-    return path; // No parent directory, or it's the root
-  }
-  else if (lastSlashPos == 0)
+  if (script && munmap(const_cast<char *>(script), file_status.st_size) == -1)
   {
-    return "/"; // The parent directory is the root
+    _perror("smash error: munmap failed");
   }
-  else
+  if (!valid)
   {
-    return path.substr(0, lastSlashPos); // Return the substring up to the last slash
+    return false;
   }
+  m_steps.swap(steps);
+  m_file_status = file_status;
+  return true;
 }
 
-// * BuiltInCommand 5 (JobsCommand)
+bool CommandPlan::isUpToDate(const struct stat &file_status) const
+{
+  return m_file_status.st_dev == file_status.st_dev &&
+         m_file_status.st_ino == file_status.st_ino &&
+         m_file_status.st_size == file_status.st_size &&
+         m_file_status.st_mtim.tv_sec == file_status.st_mtim.tv_sec &&
+         m_file_status.st_mtim.tv_nsec == file_status.st_mtim.tv_nsec;
+}
 
-JobsCommand::JobsCommand(const char *cmd_line)
-    : BuiltInCommand(cmd_line)
+bool CommandPlan::_check_syntax(const char *cmd_line, std::string *error)
 {
-  if (getName() != "jobs")
+  std::vector<std::string> stages;
+  std::vector<PipeCommand::PipeType> types;
+  PipeCommand::splitStages(cmd_line, &stages, &types);
+  for (size_t i = 0; i < stages.size(); ++i)
   {
-    throw std::logic_error("JobsCommand::JobsCommand");
+    if (stages.size() > 1 && (stages[i].empty() || stages[i] == "&"))
+    {
+      *error = "missing command in pipe";
+      return false;
+    }
+    std::string command;
+    RedirectionPlan redirections;
+    if (_is_redirection_command(stages[i].c_str()) &&
+        !redirections.parse(stages[i], &command, error))
+    {
+      return false;
+    }
   }
+  return true;
 }
 
-JobsCommand::~JobsCommand()
-{
-  // default
-}
+/* *
+ * The command dispatch table
+ */
 
-void JobsCommand::execute()
+template <class T>
+Command *_make_command(const char *cmd_line, const CommandTokens &tokens)
 {
-  // TODO: figure out what are they yapping about on " if the job was added again then the timer should reset. "
-  // getJobsList() always return an updated JobsList
-  SmallShell::getInstance().getJobsList().printJobsList();
+  return new T(cmd_line, tokens);
 }
 
-// * BuiltInCommand 6 (ForegroundCommand)
-
-ForegroundCommand::ForegroundCommand(const char *cmd_line)
-    : BuiltInCommand(cmd_line)
+// the plain cat is a built in, anything else is the external one
+Command *_make_cat_command(const char *cmd_line, const CommandTokens &tokens)
 {
-  if (getName() != "fg")
+  if (CatCommand::isSupported(tokens, _isBackgroundCommand(cmd_line)))
   {
-    throw std::logic_error("ForegroundCommand::ForegroundCommand");
+    return new CatCommand(cmd_line, tokens);
   }
-  auto jobslist = SmallShell::getInstance().getJobsList();
+  return new ExternalCommand(cmd_line, tokens);
+}
 
-  if (getArgs().size() == 0 && jobslist.size() == 0)
-  {
-    std::cerr << "smash error: fg: jobs list is empty\n";
-    throw std::logic_error("ForegroundCommand::ForegroundCommand");
-  }
+// the special commands split the line by themselves
+template <class T>
+Command *_make_special_command(const char *cmd_line, const CommandTokens &)
+{
+  return new T(cmd_line);
+}
 
-  try
+struct CommandTableEntry
+{
+  const char *name;
+  CommandFactory factory;
+};
+
+// ! must be kept sorted by name (binary searched by _find_built_in_command)
+const CommandTableEntry BUILT_IN_COMMANDS[] = {
+    {"bg", &_make_command<BackgroundCommand>},
+    {"cat", &_make_cat_command},
+    {"cd", &_make_command<ChangeDirCommand>},
+    {"chmod", &_make_command<ChmodCommand>},
+    {"chprompt", &_make_command<ChangePromptCommand>},
+    {"fg", &_make_command<ForegroundCommand>},
+    {"hash", &_make_command<HashCommand>},
+    {"history", &_make_command<HistoryCommand>},
+    {"jobs", &_make_command<JobsCommand>},
+    {"kill", &_make_command<KillCommand>},
+    {"parallel", &_make_command<ParallelCommand>},
+    {"pwd", &_make_command<GetCurrDirCommand>},
+    {"quit", &_make_command<QuitCommand>},
+    {"showpid", &_make_command<ShowPidCommand>},
+    {"source", &_make_command<SourceCommand>},
+    {"time", &_make_command<TimeCommand>},
+    {"timeout", &_make_command<TimeoutCommand>},
+    {"trace", &_make_command<TraceCommand>},
+};
+const size_t BUILT_IN_COMMANDS_COUNT = sizeof(BUILT_IN_COMMANDS) / sizeof(BUILT_IN_COMMANDS[0]);
+
+const CommandTableEntry *_find_built_in_command(const char *name, size_t length)
+{
+  size_t low = 0, high = BUILT_IN_COMMANDS_COUNT;
+  while (low < high)
   {
-    if (getArgs().size() > 0)
+    size_t mid = (low + high) / 2;
+    int cmp = strncmp(BUILT_IN_COMMANDS[mid].name, name, length);
+    if (cmp == 0 && BUILT_IN_COMMANDS[mid].name[length] != '\0') // table name is longer than the given name
     {
-      m_id = std::stoi(getArgs().front());
+      cmp = 1;
+    }
+    if (cmp == 0)
+    {
+      return &BUILT_IN_COMMANDS[mid];
+    }
+    if (cmp < 0)
+    {
+      low = mid + 1;
     }
     else
     {
-      m_id = jobslist.getLastJob()->getJobID();
+      high = mid;
     }
   }
-  catch (...)
-  {
-    std::cerr << "smash error: fg: invalid arguments\n";
-    throw std::logic_error("ForegroundCommand::ForegroundCommand");
-  }
-
-  if (getArgs().size() > 0 && jobslist.getJobById(m_id) == nullptr)
-  {
-    std::cerr << "smash error: fg: job-id " << m_id << " does not exist\n";
-    throw std::logic_error("ForegroundCommand::ForegroundCommand");
-  }
-
-  if (getArgs().size() > 1)
-  {
-    std::cerr << "smash error: fg: invalid arguments\n";
-    throw std::logic_error("ForegroundCommand::ForegroundCommand");
-  }
+  return nullptr;
 }
 
-ForegroundCommand::~ForegroundCommand()
-{
-  // default
-}
+/* *
+ * The EventLoop class
+ */
 
-void ForegroundCommand::execute()
+EventLoop::EventLoop()
+    : m_epoll(epoll_create1(EPOLL_CLOEXEC)),
+      m_input_polled(true),
+      m_input_seekable(false),
+      m_end_of_input(false),
+      m_buffer()
 {
-  auto jobslist = SmallShell::getInstance().getJobsList();
-  JobsList::JobEntry *job = jobslist.getJobById(m_id);
-  if (!job)
-  {
-    return;
-  }
-
-  if (waitpid(job->getJobPid(), nullptr, WUNTRACED) != 0) // options == 0 will wait for the process to finish
-  {
-    perror("smash error: waitpid failed");
-  }
-
-  jobslist.removeJobById(m_id);
-}
-
-// * BuiltInCommand 7 (QuitCommand)
+  struct stat input_status;
+  m_input_seekable = (fstat(STDIN_FILENO, &input_status) == 0 && S_ISREG(input_status.st_mode));
 
-QuitCommand::QuitCommand(const char *cmd_line)
-    : BuiltInCommand(cmd_line)
-{
-  if (getName() != "quit")
+  // what the loop waits for: the input, SIGCHLD (stopped or finished children), the exits of the jobs, and SIGALRM
+  int fds[] = {STDIN_FILENO, getChildNotificationsFd(), SmallShell::getInstance().getJobsList().getExitsFd(),
+               getAlarmNotificationsFd()};
+  for (int fd : fds)
   {
-    throw std::logic_error("QuitCommand::QuitCommand");
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (m_epoll != -1 && fd != -1 && epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &event) == -1)
+    {
+      if (fd == STDIN_FILENO && errno == EPERM) // a regular file (or /dev/null)
+      {
+        m_input_polled = false;
+        continue;
+      }
+      _perror("smash error: epoll_ctl failed");
+    }
   }
+  m_input_polled = m_input_polled && m_epoll != -1;
 }
 
-QuitCommand::~QuitCommand()
+EventLoop::~EventLoop()
 {
-  // default
+  if (m_epoll != -1)
+  {
+    close(m_epoll);
+  }
 }
 
-void QuitCommand::execute()
+bool EventLoop::nextLine(std::string *line)
 {
-  if (getArgs().size() > 0)
+  TRACE_SCOPE("read"); // including the time the smash waits for the line
+  while (true)
   {
-    if (getArgs().front() == "kill")
+    // when the input is not polled, the commands that timed out meanwhile are killed before the next line
+    SmallShell::getInstance().getTimeouts().poll();
+    size_t end = m_buffer.find('\n');
+    if (end != std::string::npos)
     {
-      SmallShell::getInstance().getJobsList().killAllJobs();
+      line->assign(m_buffer, 0, end);
+      m_buffer.erase(0, end + 1);
+      // the rest of a regular file is left for the commands (and read again after them)
+      if (m_input_seekable && !m_buffer.empty())
+      {
+        lseek(STDIN_FILENO, -static_cast<off_t>(m_buffer.size()), SEEK_CUR);
+        m_buffer.clear();
+      }
+      return true;
     }
-    // else, if other arguments other than "kill" were provided they will be ignored
+    if (m_end_of_input)
+    {
+      // the last line may not end with a new line
+      line->swap(m_buffer);
+      m_buffer.clear();
+      return !line->empty();
+    }
+    _wait_for_input();
   }
-  // exit the smash
-  exit(0);
 }
 
-// * BuiltInCommand 8 (KillCommand)
-
-KillCommand::KillCommand(const char *cmd_line)
-    : BuiltInCommand(cmd_line)
+void EventLoop::_wait_for_input()
 {
-  if (getName() != "kill")
-  {
-    throw std::logic_error("KillCommand::KillCommand");
-  }
-
-  if (getArgs().size() != 2)
+  if (!m_input_polled)
   {
-    std::cerr << "smash error: kill: invalid arguments\n";
-    invalidate_command();
+    _read_input();
+    return;
   }
 
-  try
+  const int MAX_EVENTS = 4;
+  struct epoll_event events[MAX_EVENTS];
+  int ready = epoll_wait(m_epoll, events, MAX_EVENTS, -1);
+  if (ready == -1)
   {
-    // should remove the - before the signal number before std::stoi
-    std::string signal_string = getArgs().front();
-    if (!signal_string.empty() && signal_string.front() == '-')
-    {
-      signal_string.erase(0, 1); // Erase the first character
-    }
-    else // signal didn't have a dash before it
+    if (errno != EINTR) // a signal handler ran (ctrl-C at the prompt, ...), just wait again
     {
-      std::cerr << "smash error: kill: invalid arguments\n";
-      invalidate_command();
+      _perror("smash error: epoll_wait failed");
+      m_input_polled = false; // falls back to a blocking read
     }
-
-    m_signal_number = std::stoi(signal_string);
-    m_job_id = std::stoi(getArgs().back());
+    return;
   }
-  catch (const std::exception &e)
+  bool input = false;
+  bool children = false;
+  for (int i = 0; i < ready; ++i)
   {
-    std::cerr << "smash error: kill: invalid arguments\n";
-    invalidate_command();
+    input = input || (events[i].data.fd == STDIN_FILENO);
+    children = children || (events[i].data.fd != STDIN_FILENO && events[i].data.fd != getAlarmNotificationsFd());
   }
-
-  // check if the job id actually exists
-  if (SmallShell::getInstance().getJobsList().getJobById(m_job_id) == nullptr)
+  // takes the notification, whichever fd was ready
+  SmallShell::getInstance().getTimeouts().poll();
+  if (children)
   {
-    std::cerr << "smash error: kill: job-id " << m_job_id << " does not exist\n";
-    invalidate_command();
+    // reaps the finished jobs (and takes the notifications, so they are not reported again)
+    SmallShell::getInstance().getJobsList();
+  }
+  if (input)
+  {
+    _read_input();
   }
 }
 
-KillCommand::~KillCommand()
-{
-  // default
-}
-
-void KillCommand::execute()
+void EventLoop::_read_input()
 {
-  JobsList &job_list = SmallShell::getInstance().getJobsList();
-  if (job_list.getJobById(m_job_id) != nullptr)
+  char chunk[1 << 16];
+  ssize_t bytes = read(STDIN_FILENO, chunk, sizeof(chunk));
+  if (bytes > 0)
   {
-    if (kill(job.getJobPid(), m_signal_number) != 0) // failure
-    {
-      perror("smash error: kill failed");
-    }
+    m_buffer.append(chunk, bytes);
+  }
+  else if (bytes == 0)
+  {
+    m_end_of_input = true;
+  }
+  else if (errno != EINTR && errno != EAGAIN)
+  {
+    _perror("smash error: read failed");
+    m_end_of_input = true;
   }
 }
 
 /* *
- * The JobsList class
+ * The OutputBuffer class
  */
 
-/* The JobEntry class methods */
-JobsList::JobEntry::JobEntry(Command *command, pid_t job_pid, unsigned int job_id)
-    : m_command(command),
-      m_job_pid(job_pid),
-      m_job_id(job_id)
+OutputBuffer::OutputBuffer()
+    : std::streambuf()
 {
+  setp(m_buffer, m_buffer + SIZE);
 }
 
-Command *JobsList::JobEntry::getCommand()
+OutputBuffer::~OutputBuffer()
 {
-  return m_command;
+  _write_buffer();
 }
 
-pid_t JobsList::JobEntry::getJobPid()
+OutputBuffer::int_type OutputBuffer::overflow(int_type c)
 {
-  return m_job_pid;
+  if (!_write_buffer())
+  {
+    return traits_type::eof();
+  }
+  if (!traits_type::eq_int_type(c, traits_type::eof()))
+  {
+    sputc(traits_type::to_char_type(c));
+  }
+  return traits_type::not_eof(c);
 }
 
-unsigned int JobsList::JobEntry::getJobID()
+int OutputBuffer::sync()
 {
-  return m_job_id;
+  return _write_buffer() ? 0 : -1;
 }
 
-/* The JobList class methods */
-unsigned int JobsList::size() const
+bool OutputBuffer::_write_buffer()
 {
-  return m_jobs.size();
+  const char *data = pbase();
+  std::size_t left = pptr() - pbase();
+  setp(m_buffer, m_buffer + SIZE); // emptied even on failure, so one bad write doesn't repeat forever
+  while (left > 0)
+  {
+    ssize_t written = write(STDOUT_FILENO, data, left);
+    if (written == -1)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return false;
+    }
+    data += written;
+    left -= written;
+  }
+  return true;
 }
 
-std::list<JobsList::JobEntry> &JobsList::getList()
+/* *
+ * The Small Shell class
+ */
+
+// * SmallShell Public
+
+// initialize the static variable in SmallShell
+const std::string SmallShell::DEFAULT_PROMPT = "smash";
+
+SmallShell::~SmallShell()
 {
-  return m_jobs;
+  std::cout.flush();
+  std::cout.rdbuf(m_original_output);
 }
 
-JobsList::JobsList()
+/**
+ * Creates and returns a pointer to Command class which matches the given command line (cmd_line)
+ */
+Command *SmallShell::CreateCommand(const char *cmd_line)
 {
-  // default
+  return CreateCommand_aux(cmd_line);
 }
 
-JobsList::~JobsList()
+void SmallShell::executeCommand(const char *cmd_line)
 {
-  // default
+  TRACE_SCOPE("line", cmd_line);
+  // no zombies are left behind between the commands
+  m_background_jobs.removeFinishedJobs();
+  _run_command(CreateCommand(cmd_line));
 }
 
-// assumes a valid command
-void JobsList::addJob(Command *cmd, pid_t pid)
+CommandFactory SmallShell::ClassifyCommand(const char *cmd_line, const CommandTokens &tokens) const
 {
-  if (cmd && waitpid(pid, nullptr, WNOHANG) != -1)
+  // special commands are recognized by their operators, before the command name is even looked at.
+  // the pipe comes first, the redirections belong to its stages
+  if (_is_pipe_command(cmd_line))
+  {
+    return &_make_special_command<PipeCommand>;
+  }
+  if (_is_redirection_command(cmd_line))
   {
-    getList().push_back(JobEntry(
-        cmd,
-        pid,
-        getList().size() ? getLastJob()->getJobID() + 1 : 1 // if there is jobs (size is true) get the last job then add 1, else give it 1 as a job id
-        ));
+    return &_make_special_command<RedirectionCommand>;
   }
+  if (tokens.size() == 0) // empty line, nothing to run
+  {
+    return nullptr;
+  }
+  const CommandTableEntry *entry = _find_built_in_command(tokens[0], tokens.length(0));
+  return entry ? entry->factory : &_make_command<ExternalCommand>;
 }
 
-void JobsList::printJobsList()
+bool SmallShell::runScript(const std::string &path)
 {
-  for (auto &job : getList())
+  if (m_running_scripts.count(path))
   {
-    std::cout << "[" << job.getJobID() << "] " << job.getCommand()->getCMDLine() << "\n";
+    std::cerr << "smash error: source: " << path << ": script is already running\n";
+    return false;
   }
-}
 
-void JobsList::killAllJobs()
-{
-  std::cout << "smash: sending SIGKILL signal to " << getList().size() << " jobs:\n";
-  for (auto &job : getList())
+  struct stat file_status;
+  if (stat(path.c_str(), &file_status) == -1)
+  {
+    _perror("smash error: stat failed");
+    return false;
+  }
+  std::map<std::string, CommandPlan>::iterator cached = m_scripts.find(path);
+  if (cached == m_scripts.end() || !cached->second.isUpToDate(file_status))
   {
-    std::cout << job.getJobPid() << ": " << job.getCommand()->getCMDLine() << "\n";
-    if (kill(job.getJobPid(), SIGKILL) != 0) // failure
+    CommandPlan plan;
+    if (!plan.load(path))
     {
-      perror("smash error: kill failed");
+      return false;
     }
+    cached = m_scripts.insert(std::make_pair(path, CommandPlan())).first;
+    std::swap(cached->second, plan);
   }
-  getList().clear();
+
+  m_running_scripts.insert(path);
+  const std::vector<CommandPlan::Step> &steps = cached->second.getSteps();
+  for (size_t i = 0; i < steps.size(); ++i)
+  {
+    _run_command(_create_command(steps[i].factory, steps[i].cmd_line.c_str(), steps[i].tokens));
+  }
+  m_running_scripts.erase(path);
+  return true;
 }
 
-void JobsList::removeFinishedJobs()
+// * SmallShell Private
+
+SmallShell::SmallShell()
+    : m_prompt(DEFAULT_PROMPT),
+      m_output(),
+      m_original_output(std::cout.rdbuf(&m_output)), // the output of the commands goes through the smash buffer
+      m_background_jobs(), // default c'tor (empty list)
+      m_path_cache(),      // default c'tor (empty cache)
+      m_timeouts(),        // default c'tor (no deadlines)
+      m_history(),         // default c'tor (not persistent until it's opened)
+      m_currForegroundPID(0),
+      m_foreground_usage(),
+      m_pid(getpid()) // `getpid()` is always successful and does not have an error return.
+{
+  // the errors are not buffered, so what was printed before them is written first
+  std::cerr.tie(&std::cout);
+}
+
+void SmallShell::waitForeground(Command *cmd, pid_t pid, unsigned int jobId, unsigned int processes)
 {
-  std::list<JobEntry>::iterator it = getList().begin();
-  for (auto &job : getList())
+  TRACE_SCOPE("wait");
+  // the signal handlers write their messages directly, after whatever the smash printed so far
+  std::cout.flush();
+  // the signal handlers forward ctrl-C / ctrl-Z to this process (group)
+  m_currForegroundPID = pid;
+  cmd->markStarted();
+  // the job is a process group led by pid, waited for as a unit (the first stage of a pipeline may be gone already)
+  pid_t waited = -pid;
+
+  // SIGCHLD and SIGALRM are only let in while ppoll sleeps, so a change between the check and the sleep is not missed
+  sigset_t child_signal, previous_mask;
+  sigemptyset(&child_signal);
+  sigaddset(&child_signal, SIGCHLD);
+  sigaddset(&child_signal, SIGALRM);
+  sigprocmask(SIG_BLOCK, &child_signal, &previous_mask);
+  // a single process can also be polled directly (readable once it exits)
+  struct pollfd process = {(processes > 1) ? -1 : _open_pidfd(pid), POLLIN, 0}; // -1 if it's gone
+
+  while (processes > 0)
   {
-    if (waitpid(job.getJobPid(), nullptr, WNOHANG) > 0)
+    m_timeouts.poll(); // this command, or the jobs
+    int status = 0;
+    struct rusage usage;
+    pid_t result = wait4(waited, &status, WNOHANG | WUNTRACED, &usage);
+    if (result == -1 && errno == EINTR)
     {
-      getList().erase(it++);
+      continue;
     }
-    else
+    // reaped by the jobs list before it was waited for (see JobsList::removeFinishedJobs)
+    if (result == -1 && (errno != ECHILD || (result = m_background_jobs.takeUnclaimedExit(pid, &status, &usage)) == 0))
     {
-      ++it;
+      _perror("smash error: wait4 failed");
+      break;
+    }
+    if (result == 0) // nothing yet, sleeps until the process exits or any signal (SIGCHLD, ctrl-C, ...) arrives
+    {
+      if (ppoll(&process, (process.fd != -1) ? 1 : 0, nullptr, &previous_mask) == -1 && errno != EINTR)
+      {
+        _perror("smash error: ppoll failed");
+        break;
+      }
+      continue;
+    }
+    if (WIFSTOPPED(status))
+    {
+      m_background_jobs.addJob(cmd, pid, JobsList::JobEntry::State::Stopped, jobId, processes);
+      break;
+    }
+    m_foreground_usage.add(usage);
+    reportTimedChild(result, usage);
+    if (--processes == 0)
+    {
+      m_timeouts.remove(pid);
     }
   }
-}
 
-JobsList::JobEntry *JobsList::getJobById(int jobId)
-{
-  for (auto &job : getList())
+  if (process.fd != -1)
   {
-    if (job.getJobID() == jobId)
-    {
-      return &job;
-    }
+    close(process.fd);
   }
-  return nullptr;
+  sigprocmask(SIG_SETMASK, &previous_mask, nullptr);
+  m_currForegroundPID = 0;
 }
 
-void JobsList::removeJobById(int jobId)
+void SmallShell::enterChild()
 {
-  for (std::list<JobEntry>::iterator it = getList().begin(); it != getList().end(); ++it)
+  signal(SIGTSTP, SIG_DFL);
+  signal(SIGINT, SIG_DFL);
+  if (!renewNotifications())
   {
-    if ((*it).getJobID() == jobId)
-    {
-      getList().erase(it);
-      break;
-    }
+    _perror("smash error: pipe failed");
   }
+  m_timeouts.clear(); // an alarm of the smash would kill the child
+  m_timed_children.clear();
+  m_background_jobs.closeDescriptors();
 }
 
-JobsList::JobEntry *JobsList::getLastJob(int *lastJobId)
+CommandPathCache &SmallShell::getPathCache()
 {
-  return getList().size() ? &getList().back() : nullptr;
+  return m_path_cache;
 }
 
-JobsList::JobEntry *JobsList::getLastStoppedJob(int *jobId)
+TimeoutScheduler &SmallShell::getTimeouts()
 {
-  return nullptr; // TODO implement
+  return m_timeouts;
 }
 
-/* *
- * The Small Shell class
- */
-
-// * SmallShell Public
-
-// initialize the static variable in SmallShell
-const std::string SmallShell::DEFAULT_PROMPT = "smash";
-
-SmallShell::~SmallShell()
+CommandHistory &SmallShell::getHistory()
 {
-  // default
+  return m_history;
 }
 
-/**
- * Creates and returns a pointer to Command class which matches the given command line (cmd_line)
- */
-Command *SmallShell::CreateCommand(const char *cmd_line)
+ResourceUsage SmallShell::takeForegroundUsage()
 {
-  return CreateCommand_aux(cmd_line);
+  ResourceUsage usage = m_foreground_usage;
+  m_foreground_usage = ResourceUsage();
+  return usage;
 }
 
-void SmallShell::executeCommand(const char *cmd_line)
+void SmallShell::timeChild(pid_t pid)
 {
-  Command *cmd = CreateCommand(cmd_line);
-  if (cmd)
-  {
-
-    cmd->execute();
-  }
+  m_timed_children[pid] = _monotonic_seconds();
 }
 
-// * SmallShell Private
-
-SmallShell::SmallShell()
-    : m_prompt(DEFAULT_PROMPT),
-      m_background_jobs(), // default c'tor (empty list)
-      m_currForegroundPID(0)
+void SmallShell::reportTimedChild(pid_t pid, const struct rusage &usage)
 {
+  std::unordered_map<pid_t, double>::iterator timed = m_timed_children.find(pid);
+  if (timed == m_timed_children.end())
+  {
+    return;
+  }
+  double wall_seconds = _monotonic_seconds() - timed->second;
+  m_timed_children.erase(timed);
+  ResourceUsage used;
+  used.add(usage);
+  std::cout << "smash: time: ";
+  used.print(wall_seconds);
+  std::cout << std::endl; // a background child may be reaped while the smash waits for input
 }
 
 JobsList &SmallShell::getJobsList()
@@ -1224,104 +4439,39 @@ void SmallShell::setPrompt(const std::string &newPrompt)
 
 Command *SmallShell::CreateCommand_aux(const char *cmd_line)
 {
-  try
-  {
-    return new RedirectionCommand(cmd_line);
-  }
-  catch (const std::exception &e)
-  {
-    std::cout << e.what() << '\n';
-  }
-
-  try
-  {
-    return new PipeCommand(cmd_line);
-  }
-  catch (const std::exception &e)
-  {
-    std::cout << e.what() << '\n';
-  }
-
-  try
-  {
-    return new ChangePromptCommand(cmd_line);
-  }
-  catch (const std::exception &e)
-  {
-    std::cout << e.what() << '\n';
-  }
-
-  try
-  {
-    return new ShowPidCommand(cmd_line);
-  }
-  catch (const std::exception &e)
-  {
-    std::cout << e.what() << '\n';
-  }
-
-  try
-  {
-    return new GetCurrDirCommand(cmd_line);
-  }
-  catch (const std::exception &e)
-  {
-    std::cout << e.what() << '\n';
-  }
-
-  try
-  {
-    return new JobsCommand(cmd_line);
-  }
-  catch (const std::exception &e)
-  {
-    std::cout << e.what() << '\n';
-  }
-
-  try
-  {
-    return new ForegroundCommand(cmd_line);
-  }
-  catch (const std::exception &e)
-  {
-    std::cout << e.what() << '\n';
-  }
-
-  try
-  {
-    return new QuitCommand(cmd_line);
-  }
-  catch (const std::exception &e)
-  {
-    std::cout << e.what() << '\n';
-  }
+  // the line is tokenized once here, and the tokens are handed to the command
+  TraceScope tokenize_scope("tokenize");
+  CommandTokens tokens(cmd_line);
+  tokenize_scope.end();
+  TRACE_SCOPE("dispatch");
+  return _create_command(ClassifyCommand(cmd_line, tokens), cmd_line, tokens);
+}
 
-  try
-  {
-    return new KillCommand(cmd_line);
-  }
-  catch (const std::exception &e)
+Command *SmallShell::_create_command(CommandFactory factory, const char *cmd_line, const CommandTokens &tokens)
+{
+  if (factory == nullptr)
   {
-    std::cout << e.what() << '\n';
+    return nullptr;
   }
 
   try
   {
-    return new ChmodCommand(cmd_line);
+    return factory(cmd_line, tokens);
   }
   catch (const std::exception &e)
   {
-    std::cout << e.what() << '\n';
+    // the c'tor already printed the relevant error message (if any)
+    return nullptr;
   }
+}
 
-  try
-  {
-    return new ExternalCommand(cmd_line);
-  }
-  catch (const std::exception &e)
+void SmallShell::_run_command(Command *cmd)
+{
+  if (cmd && cmd->is_valid())
   {
-    std::cout << e.what() << '\n';
+    TRACE_SCOPE("execute");
+    cmd->execute();
   }
-
-  return nullptr;
+  // unless it became a job, the next line reuses its memory (see CommandPool)
+  Command::release(cmd);
 }
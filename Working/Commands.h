@@ -3,16 +3,193 @@
 
 #include <vector>
 #include <list>
+#include <map>
+#include <unordered_map>
+#include <set>
+#include <deque>
 #include <string>
+#include <streambuf>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <glob.h>
+#include <spawn.h>
+#include <ctime>
+#include <cstdint>
 
 #define COMMAND_ARGS_MAX_LENGTH (200)
 #define COMMAND_MAX_ARGS (20)
 
+/* *
+ * A command line split into words in a single pass.
+ * The words are stored NUL-terminated in a fixed per-line arena, so the same tokens can be used
+ * both for the built in arguments and as the argv of execvp, without any heap allocations
+ * (as long as the line is shorter than COMMAND_ARGS_MAX_LENGTH and has at most COMMAND_MAX_ARGS arguments).
+ * A trailing background sign (&) is not part of any word.
+ */
+class CommandTokens
+{
+public:
+  /* methods */
+  explicit CommandTokens(const char *cmd_line);
+
+  unsigned int size() const { return m_count; }
+  const char *operator[](unsigned int index) const { return arena() + span(index).offset; }
+  unsigned int length(unsigned int index) const { return span(index).length; }
+  std::string str(unsigned int index) const { return std::string((*this)[index], length(index)); }
+  char **argv(); // NULL terminated, valid as long as the tokens are alive
+
+private:
+  /* types */
+  struct Span
+  {
+    unsigned int offset; // offsets (and not pointers) keep the tokens copyable
+    unsigned int length;
+  };
+
+  /* variables */
+  char m_arena[COMMAND_ARGS_MAX_LENGTH + 1];
+  Span m_spans[COMMAND_MAX_ARGS + 1]; // the command name + COMMAND_MAX_ARGS arguments
+  char *m_argv[COMMAND_MAX_ARGS + 2];
+  unsigned int m_count;
+  // only used by lines that don't fit in the fixed arrays above
+  std::vector<char> m_long_arena;
+  std::vector<Span> m_more_spans;
+  std::vector<char *> m_long_argv;
+
+  /* methods */
+  const char *arena() const { return m_long_arena.empty() ? m_arena : &m_long_arena[0]; }
+  char *arena() { return m_long_arena.empty() ? m_arena : &m_long_arena[0]; }
+  const Span &span(unsigned int index) const
+  {
+    return (index <= COMMAND_MAX_ARGS) ? m_spans[index] : m_more_spans[index - (COMMAND_MAX_ARGS + 1)];
+  }
+};
+
+/* *
+ * The redirections of one command, as a list of operations on its file descriptors (applied in order).
+ * The files are opened by the smash itself (close-on-exec), so errors are reported before anything runs,
+ * and then only dup2-ed onto the redirected descriptors in the child (or by posix_spawn).
+ * The descriptors of the smash itself are only changed for built in commands, see ScopedRedirection.
+ *
+ * The grammar (parse), with several redirections per command:
+ *    [n]< file     [n]> file     [n]>> file     [n]>&m     &> file     &>> file     [n]<<< word
+ */
+class RedirectionPlan
+{
+public:
+  /* types */
+  enum class Kind
+  {
+    File,      // opened with the flags
+    Duplicate, // of another descriptor of the command (2>&1)
+    Text       // a here-string, the text and a new line in an anonymous file
+  };
+  struct Operation
+  {
+    Kind kind;
+    int fd;           // the redirected descriptor
+    std::string text; // the path of a File, the content of a Text
+    int flags;
+    int source;       // the opened file, or the duplicated descriptor. -1 while closed
+  };
+
+  /* methods */
+  RedirectionPlan();
+  // splits the line into the command and its redirections, false on syntax errors (described in error)
+  bool parse(const std::string &cmd_line, std::string *command, std::string *error);
+  void addFile(int fd, const std::string &path, int flags);
+  void addDuplicate(int fd, int source);
+  void addText(int fd, const std::string &text);
+  bool empty() const { return m_operations.empty(); }
+  bool open();  // false on failure (already reported, nothing is left open)
+  void close(); // once the command started (or was run), the children have their own copies
+  bool apply() const; // in the current process (a child), false on failure (already reported)
+  // false if a file was opened right onto its redirected descriptor, the child has to clear its close-on-exec flag
+  bool spawnable() const;
+  void addTo(posix_spawn_file_actions_t *actions) const;
+  const std::vector<Operation> &getOperations() const { return m_operations; }
+
+private:
+  /* variables */
+  std::vector<Operation> m_operations;
+
+  /* methods */
+  static size_t _read_word(const std::string &cmd_line, size_t start, std::string *word); // returns the end of the word
+};
+
+/* *
+ * Applies an (opened) redirection plan to the smash itself for as long as it is alive,
+ * the original descriptors are restored (and their saved copies closed) on destruction.
+ */
+class ScopedRedirection
+{
+public:
+  /* methods */
+  explicit ScopedRedirection(const RedirectionPlan &plan);
+  ~ScopedRedirection();
+  ScopedRedirection(const ScopedRedirection &) = delete;
+  void operator=(const ScopedRedirection &) = delete;
+  bool isApplied() const { return m_applied; }
+
+private:
+  /* types */
+  struct Saved
+  {
+    int fd;
+    int copy; // -1 if fd was not open
+  };
+
+  /* variables */
+  std::vector<Saved> m_saved; // in the order they were redirected
+  bool m_applied;
+};
+
+class Command;
+
+std::string _trim(const std::string &s); // without the leading and trailing whitespace
+// like perror, after the buffered output of the smash (std::cerr is tied to std::cout for the same reason)
+void _perror(const char *message);
+
+/* *
+ * Creates the command matching an already classified command line (see SmallShell::ClassifyCommand)
+ */
+typedef Command *(*CommandFactory)(const char *cmd_line, const CommandTokens &tokens);
+
+/* *
+ * The CommandPool class
+ * Every command is allocated from here (see Command::operator new). A deleted command is kept on the free list
+ * of its size class and reused by the next command of that size, so the memory of the smash grows with the number
+ * of commands that are alive at the same time (the jobs, and the line being executed), and not with the number of lines.
+ * The blocks are never given back, the pool lives as long as the smash.
+ */
+class CommandPool
+{
+public:
+  /* methods */
+  static void *allocate(size_t size);
+  static void deallocate(void *block, size_t size);
+
+private:
+  /* types */
+  struct FreeBlock
+  {
+    FreeBlock *next;
+  };
+
+  /* variables */
+  static const size_t GRANULARITY = 64;
+  static const size_t SIZE_CLASSES = 32; // up to 2 KiB, bigger commands come straight from the heap
+  static FreeBlock *FREE_LISTS[SIZE_CLASSES];
+};
+
 /**
  * All commands has the following atributes
  *    the command_line
  *    are background or foreground (this can be ignored during the command execution)
  * Not all commands has a name (pipe for example) so we wont have anything else here
+ *
+ * Ownership: a command is deleted by whoever created it (the smash after it ran, or the command it's a part of),
+ * unless it became a job by then. A job is owned by the jobs list, which deletes it when the job is removed.
  */
 class Command
 {
@@ -26,20 +203,51 @@ class Command
   GroundType m_ground_type; // should come before the command line
   std::string m_cmd_line;   // command line
   bool m_valid;
+  unsigned int m_timeout;         // in seconds, 0 if the command is not timed
+  std::string m_timeout_cmd_line; // of the timeout command, reported when the time is up
+  std::string m_job_cmd_line;     // of the command it's part of (a redirection, ...), empty if it's the whole line
+  bool m_job;                     // owned by the jobs list
+  double m_start_time;            // in seconds (CLOCK_MONOTONIC), 0 until its process is started
 
 public:
   /* methods */
   Command(const char *cmd_line);
   virtual ~Command();
+  static void *operator new(size_t size) { return CommandPool::allocate(size); }
+  static void operator delete(void *block, size_t size) { CommandPool::deallocate(block, size); }
+  static void release(Command *command); // deletes the command, unless it's a job
   virtual void execute() = 0;
+  [[noreturn]] virtual void executeInChild(); // runs the command in an already forked child (a pipeline stage)
+  // true if the command applies the (opened) redirections in its own children,
+  // otherwise they are applied to the smash around execute()
+  virtual bool acceptRedirections(const RedirectionPlan &) { return false; }
   // virtual void prepare(); // ? what are these
   // virtual void cleanup(); // ? what are these
   const std::string &getCMDLine() const { return m_cmd_line; }
+  // the whole line it's part of (with the redirections, timeout, ...), as the jobs list shows it
+  const std::string &getJobCMDLine() const { return m_job_cmd_line.empty() ? m_cmd_line : m_job_cmd_line; }
+  virtual void setJobCMDLine(const std::string &cmd_line) { m_job_cmd_line = cmd_line; }
   bool isBackground() const { return m_ground_type == GroundType::Background; }
   std::string m_remove_background_sign(const char *cmd_line) const;
 
   void invalidate_command() { m_valid = false; }
   bool is_valid() const { return m_valid; }
+  bool isJob() const { return m_job; }
+  void setJob(bool job) { m_job = job; } // by the jobs list
+  // when the process of the command is first waited for (or added as a job), a job that was resumed started once
+  void markStarted();
+  double getStartTime() const { return m_start_time; }
+  // the process (group) of the command is killed once the seconds pass, see TimeoutScheduler.
+  // false if the command can't be timed (it runs in the smash itself)
+  virtual bool setTimeout(unsigned int seconds, const std::string &cmd_line);
+  // by the parent, for a command that runs in place in the child pid (see executeInChild), with group if the child
+  // leads its own process group: schedules its deadline (and its timing, see TimeCommand). nothing by default,
+  // executeInChild runs execute() which does it by itself
+  virtual void childStarted(pid_t, bool) const {}
+
+protected:
+  // after the command was started, if it is timed. with group, the whole process group of pid is killed
+  void _schedule_timeout(pid_t pid, bool group = true) const;
 };
 
 /*
@@ -53,21 +261,49 @@ public:
  */
 class ExternalCommand : public Command
 {
+public:
   /* types */
-  enum class Complexity
+  enum class LaunchEngine
   {
-    Simple,
-    Complex
+    Auto,  // chosen per command, Spawn unless the child has some work to do before the exec
+    Spawn, // posix_spawn, no copy of the smash page tables, the child can't run any code of ours
+    Fork   // fork + exec, the child can run code of ours before the exec
   };
-  Complexity m_complexity;
 
-  /* methods */
-  Complexity _get_complexity_type(const char *cmd_line);
+  /* static variables */
+  static LaunchEngine LAUNCH_ENGINE; // originally set to Auto (in .cpp), forced only to compare the engines
 
-public:
-  ExternalCommand(const char *cmd_line);
+  /* methods */
+  ExternalCommand(const char *cmd_line, const CommandTokens &tokens);
   virtual ~ExternalCommand();
   void execute() override;
+  [[noreturn]] void executeInChild() override;
+  void childStarted(pid_t pid, bool group) const override { _schedule_timeout(pid, group); }
+  bool acceptRedirections(const RedirectionPlan &plan) override;
+
+private:
+  /* types */
+  enum class Complexity
+  {
+    Simple,  // executed as is
+    Glob,    // has wildcards, expanded by smash before the exec
+    Complex  // has wildcards and syntax only bash understands, executed through bash
+  };
+  Complexity m_complexity;
+  CommandTokens m_tokens;
+  RedirectionPlan m_redirections;
+
+  /* methods */
+  Complexity _get_complexity_type(const CommandTokens &tokens);
+  bool _expand_wildcards(glob_t *expanded);
+  int _spawn_resolved(pid_t *pid, const posix_spawn_file_actions_t *actions, const posix_spawnattr_t *attributes,
+                      char **args); // returns the posix_spawn error
+  // returns only on failure, a cached executable that is gone is written to stale_fd (if not -1)
+  void _exec_resolved(char **args, int stale_fd);
+  LaunchEngine _launch_engine() const;
+  pid_t _spawn();
+  pid_t _fork_and_exec();
+  [[noreturn]] void _exec(int stale_fd);
 };
 
 /*
@@ -75,8 +311,9 @@ public:
  */
 
 /* *
- * The pipe command contains 2 commands and the type of piping (| or |&)
+ * The pipe command contains 2 or more commands (stages) and the type of piping (| or |&) between each two of them
  * If you see the character "|" or "|&" in the command, then its a pipe :-)
+ * All the stages run at the same time (each in its own child) in one process group, which is waited for as a unit.
  */
 class PipeCommand : public Command
 {
@@ -84,8 +321,8 @@ public:
   /* types */
   enum class PipeType
   {
-    Standard,
-    Error
+    Standard, // |  stdout to stdin
+    Error     // |& stderr to stdin
   };
 
   /* methods */
@@ -93,45 +330,36 @@ public:
   virtual ~PipeCommand();
   void execute() override;
 
+  static void splitStages(const std::string &cmd_line, std::vector<std::string> *stages, std::vector<PipeType> *types);
+
 private:
   /* variables */
-  PipeType m_pipe_type;
-  Command *m_cmd_1;
-  Command *m_cmd_2;
+  std::vector<Command *> m_stages;
+  std::vector<PipeType> m_pipe_types; // m_pipe_types[i] is the pipe between stage i and stage i + 1
 
-  PipeCommand::PipeType _get_pipe_type(const char *cmd_line);
-  Command *_get_cmd_1(const char *cmd_line);
-  Command *_get_cmd_2(const char *cmd_line);
+  /* methods */
+  void _release_stages();
 };
 
 /* *
- * The RedirectionCommand command contains 1 command first and
- * a file second separated by a `>` or a `>>` for overriding
- * and appending respectively.
- * If you see the character ">" or ">>" in the command, then its a RedirectionCommand
+ * The RedirectionCommand command contains 1 command and its redirections (see RedirectionPlan for the grammar)
+ * If you see the character "<" or ">" in the command (of a pipeline stage), then its a RedirectionCommand
  */
 class RedirectionCommand : public Command
 {
-  /* types */
-  enum class RedirectionType
-  {
-    Override,
-    Append
-  };
   /* variables */
-  RedirectionType m_redirection_type;
   Command *m_command;
-  std::string m_file_path; // the path can be absolute or relative
-
-  RedirectionType get_redirection_type(const char *cmd_line);
+  RedirectionPlan m_redirections;
 
 public:
   /* methods */
   explicit RedirectionCommand(const char *cmd_line);
   virtual ~RedirectionCommand();
   void execute() override;
-  // void prepare() override; // ? what are these
-  // void cleanup() override; // ? what are these
+  [[noreturn]] void executeInChild() override;
+  bool setTimeout(unsigned int seconds, const std::string &cmd_line) override; // of the redirected command
+  void childStarted(pid_t pid, bool group) const override;
+  void setJobCMDLine(const std::string &cmd_line) override;                  // of the redirected command
 };
 
 /*
@@ -147,9 +375,10 @@ class BuiltInCommand : public Command
 {
 public:
   /* methods */
-  BuiltInCommand(const char *cmd_line);
+  BuiltInCommand(const char *cmd_line, const CommandTokens &tokens);
   virtual ~BuiltInCommand();
   virtual void execute() = 0;
+  bool setTimeout(unsigned int, const std::string &) override { return false; } // unless it runs in a child
 
   unsigned int numOfArgs() const { return m_args.size(); }
   const std::string &getName() const { return m_name; }
@@ -159,9 +388,6 @@ private:
   /* variables */
   std::string m_name;
   std::vector<std::string> m_args;
-  /* methods */
-  std::string m_parse_name(const char *cmd_line) const;
-  std::vector<std::string> m_parse_args(const char *cmd_line) const;
 };
 
 /** Command number 1:
@@ -172,7 +398,7 @@ private:
 class ChangePromptCommand : public BuiltInCommand
 {
 public:
-  ChangePromptCommand(const char *cmd_line);
+  ChangePromptCommand(const char *cmd_line, const CommandTokens &tokens);
   virtual ~ChangePromptCommand();
   void execute() override;
 };
@@ -184,7 +410,7 @@ public:
 class ShowPidCommand : public BuiltInCommand
 {
 public:
-  ShowPidCommand(const char *cmd_line);
+  ShowPidCommand(const char *cmd_line, const CommandTokens &tokens);
   virtual ~ShowPidCommand();
   void execute() override;
 };
@@ -198,7 +424,7 @@ public:
 class GetCurrDirCommand : public BuiltInCommand
 {
 public:
-  GetCurrDirCommand(const char *cmd_line);
+  GetCurrDirCommand(const char *cmd_line, const CommandTokens &tokens);
   virtual ~GetCurrDirCommand();
   void execute() override;
 };
@@ -218,13 +444,13 @@ public:
 class ChangeDirCommand : public BuiltInCommand
 {
   /* static variables */
-  static std::list<std::string> CD_PATH_HISTORY;
+  static std::string OLD_PWD; // only the last directory is ever needed (by "cd -"), empty if not set
 
   /* methods */
   std::string get_parent_directory(const std::string &path) const;
 
 public:
-  ChangeDirCommand(const char *cmd_line);
+  ChangeDirCommand(const char *cmd_line, const CommandTokens &tokens);
   virtual ~ChangeDirCommand();
   void execute() override;
 };
@@ -237,8 +463,9 @@ class JobsList;
  */
 class JobsCommand : public BuiltInCommand
 {
+  bool m_verbose; // `jobs -v`, with the resource usage of the jobs (see JobsList::printJobsList)
 public:
-  JobsCommand(const char *cmd_line);
+  JobsCommand(const char *cmd_line, const CommandTokens &tokens);
   virtual ~JobsCommand();
   void execute() override;
 };
@@ -250,18 +477,38 @@ class ForegroundCommand : public BuiltInCommand
 {
   int m_id;
 public:
-  ForegroundCommand(const char *cmd_line);
+  ForegroundCommand(const char *cmd_line, const CommandTokens &tokens);
   virtual ~ForegroundCommand();
   void execute() override;
 };
 
+/**
+ * @brief `bg` command resumes a stopped job in the background (by sending it SIGCONT).
+ *    The job-id argument is optional, without it the stopped job with the maximal job id is resumed.
+ *    bg prints the command line of that job along with its pid.
+ *
+ *    If the job is already running, then bg command should print the following error message:
+ *        ```smash error: bg: job-id <job-id> is already running in the background```
+ *    If no job-id was specified and there are no stopped jobs, then bg command should print the following error message:
+ *        ```smash error: bg: there is no stopped jobs to resume```
+ *    Otherwise the errors are the same as in the fg command.
+ */
+class BackgroundCommand : public BuiltInCommand
+{
+  int m_id;
+public:
+  BackgroundCommand(const char *cmd_line, const CommandTokens &tokens);
+  virtual ~BackgroundCommand();
+  void execute() override;
+};
+
 /** Command number 7:
  * @brief
  */
 class QuitCommand : public BuiltInCommand
 {
 public:
-  QuitCommand(const char *cmd_line);
+  QuitCommand(const char *cmd_line, const CommandTokens &tokens);
   virtual ~QuitCommand();
   void execute() override;
 };
@@ -276,7 +523,7 @@ class KillCommand : public BuiltInCommand
   unsigned int m_job_id;
 
 public:
-  KillCommand(const char *cmd_line);
+  KillCommand(const char *cmd_line, const CommandTokens &tokens);
   virtual ~KillCommand();
   void execute() override;
 };
@@ -287,13 +534,404 @@ public:
 class ChmodCommand : public BuiltInCommand
 {
 public:
-  ChmodCommand(const char *cmd_line);
+  ChmodCommand(const char *cmd_line, const CommandTokens &tokens);
   virtual ~ChmodCommand();
   void execute() override;
 };
 
+/**
+ * @brief `source` command receives a single argument <path> of a script file and runs its lines in the current smash.
+ *    The script is parsed once (see CommandPlan) and the plan is cached, so sourcing it again does not parse it again
+ *    (unless the file has changed in the meantime).
+ *
+ *    If not exactly one argument was provided, then source command should print the following error message:
+ *        ```smash error: source: invalid arguments```
+ */
+class SourceCommand : public BuiltInCommand
+{
+public:
+  SourceCommand(const char *cmd_line, const CommandTokens &tokens);
+  virtual ~SourceCommand();
+  void execute() override;
+};
+
+/**
+ * @brief `hash` command prints the executables smash remembers (see CommandPathCache) along with their number of hits.
+ *    `hash -r` makes smash forget all of them.
+ *
+ *    If any other arguments were provided, then hash command should print the following error message:
+ *        ```smash error: hash: invalid arguments```
+ */
+class HashCommand : public BuiltInCommand
+{
+public:
+  HashCommand(const char *cmd_line, const CommandTokens &tokens);
+  virtual ~HashCommand();
+  void execute() override;
+};
+
+/**
+ * @brief `cat` command copies its files (or its standard input when there are none, or for "-") to its standard output.
+ *    The bytes are moved inside the kernel (copy_file_range between files, splice into a pipe or from a pipe into a
+ *    socket, sendfile from a file), so moving big files through smash costs almost no CPU in smash itself.
+ *    It only handles the plain form: with options, wildcards or in the background, the external cat runs instead.
+ *    Regular files are copied by smash itself, in chunks that ctrl-C can stop between. Anything else (a terminal,
+ *    a pipe, /dev/zero, ...) may never end, so it's copied by a child in the foreground, which ctrl-C and ctrl-Z
+ *    can reach like any external command.
+ *
+ *    If a file can't be opened or copied, then the following error message is printed and the rest of the files are still copied:
+ *        ```smash error: cat: <file>: <error>```
+ *    A file that is also the output is not copied (it would never end):
+ *        ```smash error: cat: <file>: input file is output file```
+ */
+class CatCommand : public BuiltInCommand
+{
+public:
+  CatCommand(const char *cmd_line, const CommandTokens &tokens);
+  virtual ~CatCommand();
+  void execute() override;
+  [[noreturn]] void executeInChild() override;
+  bool acceptRedirections(const RedirectionPlan &plan) override;
+  bool setTimeout(unsigned int seconds, const std::string &cmd_line) override; // only a child is timed
+  void childStarted(pid_t pid, bool group) const override { _schedule_timeout(pid, group); }
+
+  static bool isSupported(const CommandTokens &tokens, bool background);
+
+private:
+  /* variables */
+  RedirectionPlan m_redirections; // applied to the smash while it copies, or only to the child
+
+  /* methods */
+  bool _reads_stream() const; // true if any of the inputs is not a regular file
+  bool _copy_files() const;   // false if any of them failed (already reported)
+};
+
+/**
+ * @brief `parallel [-j <N>] [file]` command runs the command lines of the file (or of its standard input when there is none),
+ *    keeping exactly N of them running at a time (by default, the number of online CPUs), and waits for all of them.
+ *    Every running line is a job in the jobs list. When a line fails, parallel prints how it ended:
+ *        ```smash: parallel: <cmd-line> exited with status <status>``` or ```smash: parallel: <cmd-line> was killed by signal <signal>```
+ *    or ```smash: parallel: <cmd-line> is not a valid command``` (after the error of the command itself, if it has one).
+ *    ctrl-C kills all the running lines and ctrl-Z stops them, no more lines are started after either of them.
+ *    A line that was stopped is left in the jobs list (and no longer waited for):
+ *        ```smash: parallel: <cmd-line> was stopped```
+ *    and at the end, it prints the following summary:
+ *        ```smash: parallel: <number> commands, <number> failed```
+ *
+ *    If N is not a positive number or more than one file was given, then parallel command should print the following error message:
+ *        ```smash error: parallel: invalid arguments```
+ */
+class ParallelCommand : public BuiltInCommand
+{
+public:
+  ParallelCommand(const char *cmd_line, const CommandTokens &tokens);
+  virtual ~ParallelCommand();
+  void execute() override;
+
+private:
+  /* variables */
+  unsigned int m_slots;
+  std::string m_path; // empty for the standard input
+
+  /* methods */
+  bool _read_lines(std::vector<std::string> *lines) const; // false on failure (already reported)
+  pid_t _launch(Command *command) const;                   // -1 on failure (already reported)
+  static int _wait_for_children();                         // until any child changes its state, or ctrl-C / ctrl-Z
+};
+
+/**
+ * @brief `timeout <duration> <command>` runs the command, and kills it (SIGKILL) if it is still running after duration seconds.
+ *    Then smash prints the following message:
+ *        ```smash: <command-line> timed out!``` where <command-line> is the whole timeout command
+ *
+ *    If duration is not a non-negative number or no command was given, then timeout command should print the following error message:
+ *        ```smash error: timeout: invalid arguments```
+ *    Built in commands run in the smash itself and can't be killed (only cat, when it copies in a child), for them
+ *    timeout command should print the following error message:
+ *        ```smash error: timeout: <command> is a built in command```
+ */
+class TimeoutCommand : public BuiltInCommand
+{
+public:
+  TimeoutCommand(const char *cmd_line, const CommandTokens &tokens);
+  virtual ~TimeoutCommand();
+  void execute() override;
+  // execs the timed command in place, so it stays in the process group of the pipeline (or parallel line)
+  [[noreturn]] void executeInChild() override;
+  void childStarted(pid_t pid, bool group) const override;
+  void setJobCMDLine(const std::string &cmd_line) override; // of the timed command
+
+private:
+  /* variables */
+  Command *m_command;
+};
+
+/**
+ * @brief `time <command>` runs the command, and then prints what it used (see ResourceUsage):
+ *        ```smash: time: real <seconds>s, user <seconds>s, sys <seconds>s, max rss <KiB> KiB, <count> context switches```
+ *    The usage is of the foreground processes of the command, and of the smash itself for the built in commands.
+ *    In a pipeline (or a parallel line) the usage is of the stage alone, printed once the smash reaps it.
+ *
+ *    If no command was given, then time command should print the following error message:
+ *        ```smash error: time: invalid arguments```
+ */
+class TimeCommand : public BuiltInCommand
+{
+public:
+  TimeCommand(const char *cmd_line, const CommandTokens &tokens);
+  virtual ~TimeCommand();
+  void execute() override;
+  // execs the timed command in place, so it stays in the process group of the pipeline (or parallel line). the
+  // parent prints its usage once it reaps it (see SmallShell::reportTimedChild)
+  [[noreturn]] void executeInChild() override;
+  void childStarted(pid_t pid, bool group) const override;
+  bool setTimeout(unsigned int seconds, const std::string &cmd_line) override; // of the timed command
+  void setJobCMDLine(const std::string &cmd_line) override;                  // of the timed command
+
+private:
+  /* variables */
+  Command *m_command;
+};
+
+/**
+ * @brief `trace on [file]` starts recording the phases of every line (see Tracer), and `trace off` writes them
+ *    to the file (smash_trace.json by default) as a Chrome trace:
+ *        ```smash: trace: <count> events written to <file>```
+ *    `smash --trace <file>` starts the smash with tracing on.
+ *
+ *    If any other arguments were provided, then trace command should print the following error message:
+ *        ```smash error: trace: invalid arguments```
+ */
+class TraceCommand : public BuiltInCommand
+{
+public:
+  /* static variables */
+  static const char *const DEFAULT_PATH;
+
+  /* methods */
+  TraceCommand(const char *cmd_line, const CommandTokens &tokens);
+  virtual ~TraceCommand();
+  void execute() override;
+
+private:
+  /* variables */
+  bool m_on;
+  std::string m_path; // for `trace on`, empty for the previous one
+};
+
+/**
+ * @brief `history` command prints the command lines of the smash (see CommandHistory), numbered from 1.
+ *    `history -s <text>` prints only the ones that contain the text.
+ *
+ *    If any other arguments were provided, then history command should print the following error message:
+ *        ```smash error: history: invalid arguments```
+ */
+class HistoryCommand : public BuiltInCommand
+{
+public:
+  HistoryCommand(const char *cmd_line, const CommandTokens &tokens);
+  virtual ~HistoryCommand();
+  void execute() override;
+
+private:
+  /* variables */
+  std::string m_text; // searched for, empty to print everything
+};
+
+/* *
+ * The CommandPathCache class
+ * Maps the names of external commands to the executables found for them in the PATH (like the bash `hash`),
+ * so the PATH is searched once per command instead of once per launch.
+ * The whole cache is dropped when the PATH changes, and an entry is dropped when its executable is gone.
+ */
+
+class CommandPathCache
+{
+public:
+  /* methods */
+  CommandPathCache();
+  // false if there is no such executable in the PATH, or the name is a path by itself (has a slash)
+  bool resolve(const char *name, std::string *path);
+  void forget(const char *name);
+  void clear();
+  void print() const;
+
+private:
+  /* types */
+  struct Entry
+  {
+    std::string path;
+    unsigned int hits;
+  };
+
+  /* variables */
+  std::unordered_map<std::string, Entry> m_entries;
+  std::string m_path; // the PATH the entries were resolved with
+};
+
+/* *
+ * The CommandHistory class
+ * The command lines of the smash, in an append-only log (one line per entry). The log is only memory mapped
+ * when the history is needed, and only the part that was added since the last time is scanned for new entries.
+ * Searches go through a trigram index (the exact 3 bytes -> the entries that contain them, in ascending order).
+ * The index of the log is kept in a file next to it (<log>.index), which is memory mapped and searched as is.
+ * The entries that were added after it are indexed in memory by the first search, and once there are enough of
+ * them the index file is written again (merged with them), so a search never indexes many of them.
+ * Without a log file, the history is kept in an anonymous file (and indexed in memory) for the session only.
+ */
+
+class CommandHistory
+{
+public:
+  /* methods */
+  CommandHistory();
+  ~CommandHistory();
+  CommandHistory(const CommandHistory &) = delete;
+  void operator=(const CommandHistory &) = delete;
+  void open(const std::string &path); // nothing is read until the history is needed
+  void add(const std::string &cmd_line);
+  void print();
+  void search(const std::string &text); // prints the entries that contain the text
+
+private:
+  /* types */
+  // the index file: the header, the offsets of its entries in the log, the trigrams (ascending) and the entries of
+  // every trigram (ascending, from IndexTrigram::first). in the byte order of the machine, it's a cache only
+  struct IndexHeader
+  {
+    char magic[8];
+    uint64_t log_device; // the log it was built for
+    uint64_t log_inode;
+    uint64_t log_size; // the entries up to here
+    uint64_t entries;
+    uint64_t trigrams;
+    uint64_t postings;
+  };
+  struct IndexTrigram
+  {
+    uint32_t trigram;
+    uint32_t count;
+    uint64_t first;
+  };
+
+  /* variables */
+  static const char INDEX_MAGIC[8];
+  // the index file is written again when this many entries were added after it, so the first search of a session
+  // indexes at most that many entries in memory (and writing it again costs O(1) per entry, amortized)
+  static const size_t MIN_UNSAVED_ENTRIES = 256;
+  static const size_t UNSAVED_ENTRIES_RATIO = 1024; // and at least 1/1024 of the entries in it
+  std::string m_path;
+  int m_fd;
+  const char *m_data; // the mapped log
+  size_t m_size;
+  std::vector<size_t> m_entries; // the offsets of the entries in the log, after the ones in the index file
+  size_t m_scanned_size;         // how much of the log is in the index file and m_entries
+  const char *m_index_data;      // the mapped index file, nullptr without one
+  size_t m_index_size;
+  bool m_index_opened;           // the index file is only mapped once, written ones are mapped by _write_index
+  size_t m_index_entries;        // how many entries are in the index file
+  const uint64_t *m_index_offsets;
+  const IndexTrigram *m_index_trigrams;
+  size_t m_index_trigrams_count;
+  const uint32_t *m_index_postings;
+  std::unordered_map<uint32_t, std::vector<uint32_t>> m_trigrams; // of the entries after the index file
+  size_t m_indexed_entries;      // how many entries are in the index file and m_trigrams
+
+  /* methods */
+  static uint32_t _trigram(const char *c)
+  {
+    return (static_cast<unsigned char>(c[0]) << 16) | (static_cast<unsigned char>(c[1]) << 8) |
+           static_cast<unsigned char>(c[2]);
+  }
+  bool _open_log();
+  bool _load(); // maps the log again if it grew and scans the new entries, false on failure (already reported)
+  void _scan();       // the entries after m_scanned_size
+  void _open_index(); // maps the index file if it's of this log
+  void _close_index();
+  void _index_trigrams();
+  bool _write_index(); // the index file and the entries indexed in memory, merged. false on failure (already reported)
+  // the entries of the trigram in the index file, nullptr if there are none
+  const uint32_t *_find_indexed(uint32_t trigram, size_t *count) const;
+  void _print_entry(size_t index) const;
+  size_t _entries_count() const { return m_index_entries + m_entries.size(); }
+  size_t _entry_offset(size_t index) const
+  {
+    return (index < m_index_entries) ? m_index_offsets[index] : m_entries[index - m_index_entries];
+  }
+  const char *_entry_begin(size_t index) const { return m_data + _entry_offset(index); }
+  const char *_entry_end(size_t index) const; // at its new line
+};
+
+/* *
+ * The TimeoutScheduler class
+ * The deadlines of all the timed commands, in a min-heap. A single alarm() is armed for the earliest one,
+ * so the commands that time out together cost one SIGALRM, no matter how many are waiting.
+ * The handler (alarmHandler) only takes note of the SIGALRM, the deadlines are expired by poll, wherever the smash
+ * waits (for the next line, for the foreground command, ...). A deadline is dropped when its command is reaped:
+ * it's only marked as removed (O(1)), and left in the heap until it comes to the top (or most of the heap is removed).
+ */
+
+class TimeoutScheduler
+{
+public:
+  /* methods */
+  TimeoutScheduler();
+  void add(pid_t pid, unsigned int seconds, const std::string &cmd_line, bool group = true);
+  void remove(pid_t pid); // the command finished, O(1) amortized
+  void clear();           // in a forked child, the deadlines belong to the smash
+  void poll();            // expires the deadlines if SIGALRM arrived since the last call, O(1) otherwise
+  void expire();          // kills the commands whose time is up and are still running
+
+private:
+  /* types */
+  struct Timeout
+  {
+    time_t deadline;
+    pid_t pid; // the process (group) to kill
+    bool group;
+    unsigned long serial; // removed unless it's the serial of m_live[pid] (a pid may be timed again once reused)
+    std::string cmd_line;
+
+    bool operator>(const Timeout &other) const { return deadline > other.deadline; }
+  };
+
+  /* variables */
+  std::vector<Timeout> m_heap; // the earliest deadline first (std::greater), with the removed ones
+  std::unordered_map<pid_t, unsigned long> m_live; // the serials of the deadlines that were not removed, by pid
+  unsigned long m_next_serial;
+
+  /* methods */
+  bool _is_live(const Timeout &timeout) const;
+  void _drop_removed(); // from the top of the heap, so the earliest deadline is a live one
+  void _arm() const;    // for the earliest deadline, or cancels the alarm when there is none
+};
+
+/* *
+ * The ResourceUsage struct
+ * What processes used, as reported by wait4 when they are reaped (or read from /proc while they are running).
+ * The usage of several processes (the stages of a pipeline) adds up, except for the maximal resident set size.
+ */
+struct ResourceUsage
+{
+  /* variables */
+  double user_seconds;
+  double system_seconds;
+  long max_rss;          // in KiB
+  long context_switches; // voluntary and involuntary
+
+  /* methods */
+  ResourceUsage();
+  void add(const struct rusage &usage);
+  void add(const ResourceUsage &usage);
+  bool read(pid_t pid); // of a process that was not reaped yet, false if it's gone
+  // the usage of all the processes of the process groups (the keys) that were not reaped yet, added to the values
+  static void readGroups(std::unordered_map<pid_t, ResourceUsage> *groups);
+  void print(double wall_seconds) const; // "real <seconds>s, user <seconds>s, ..." (no new line)
+};
+
 /* *
  * The JobsList class
+ * `jobs -v` also shows the usage of the jobs, and of the last jobs that finished (see MAX_FINISHED).
  */
 
 class JobsList
@@ -302,37 +940,225 @@ public:
   class JobEntry
   {
   public:
+    /* types */
+    enum class State
+    {
+      Running,
+      Stopped,
+      Done // finished, about to be removed from the list
+    };
+
     /* methods */
-    JobEntry(Command *command, pid_t job_pid, unsigned int job_id);
+    JobEntry(Command *command, pid_t job_pid, unsigned int job_id, State state, int pidfd = -1,
+             unsigned int processes = 1);
     Command *getCommand();
     pid_t getJobPid();
+    pid_t getGroup() const { return m_group; }
+    unsigned int getProcesses() const { return m_processes; }
+    int getPidfd() const { return m_pidfd; }
+    void setPidfd(int pidfd) { m_pidfd = pidfd; }
     unsigned int getJobID();
+    bool isEmpty() const { return m_command == nullptr; }
+    State getState() const { return m_state; }
+    void setState(State state);
+    time_t getInsertionTime() const { return m_insertion_time; }
+    time_t getStateChangeTime() const { return m_state_change_time; }
+    // when one of its processes is reaped (usage may be nullptr if it's unknown), true if it was the last one
+    bool processExited(int status, const struct rusage *usage);
+    int getStatus() const { return m_status; }
+    const ResourceUsage &getUsage() const { return m_usage; }
+    double getWallSeconds() const; // since it started, until it finished
 
   private:
     /* variables */
     Command *m_command;
     pid_t m_job_pid;       // since the job is run in the background we must have used fork()
+    pid_t m_group;         // the process group of the job, led by its first process (the job pid)
+    unsigned int m_processes; // that didn't exit yet, all the stages of a pipeline
+    int m_pidfd;           // refers to the first process (even if the pid is reused), -1 if not supported or reaped
     unsigned int m_job_id; // the job id in the list
+    State m_state;
+    time_t m_insertion_time;    // reset when the job is added again (after fg)
+    time_t m_state_change_time;
+    int m_status;            // as reported by wait4 for the last process that exited, -1 until then
+    ResourceUsage m_usage;   // of the processes that exited
+    double m_end_time;       // in seconds (CLOCK_MONOTONIC), 0 until it finished
   };
 
   /* methods */
   unsigned int size() const;
-  std::list<JobEntry> &getList();
 
   JobsList();
   ~JobsList();
-  void addJob(Command *cmd, pid_t pid);
-  void printJobsList();
+  JobsList(const JobsList &) = delete; // owns the pidfds of the jobs
+  void operator=(const JobsList &) = delete;
+  // a job that was in the list before (and brought to the foreground) can be added back with its previous job id.
+  // a job of several processes (a pipeline) is a process group led by pid, it's done when all of them exited
+  void addJob(Command *cmd, pid_t pid, JobEntry::State state = JobEntry::State::Running, unsigned int jobId = 0,
+              unsigned int processes = 1);
+  void setJobState(int jobId, JobEntry::State state);
+  void printJobsList(bool verbose = false); // verbose adds the resource usage and the finished jobs
   void killAllJobs();
   void removeFinishedJobs();
+  void updateJob(pid_t pid, int status, const struct rusage *usage = nullptr); // applies a state change reported by wait4
+  // the exit status of the process is kept when it's reaped (by anyone), until it's taken
+  void keepExitStatus(pid_t pid);
+  bool takeExitStatus(pid_t pid, int *status); // false if it was not reaped yet
+  void forgetExitStatus(pid_t pid);
+  // the returned entries are valid until the list is changed
   JobEntry *getJobById(int jobId);
-  void removeJobById(int jobId);
+  JobEntry *getJobByPid(pid_t pid);
+  void removeJobById(int jobId); // and deletes its command
+  Command *takeJob(int jobId);   // removes the job, its command is handed to the caller (nullptr if there is no such job)
+  // through the pidfd of the job, so it can't reach another process that got its pid.
+  // with group, to the whole process group of the job. false on failure (errno is set)
+  bool sendSignal(int jobId, int signal, bool group = false);
+  int getExitsFd() const { return m_exits; } // readable when a job exited (then removeFinishedJobs reaps it)
+  // a process of the group that exited and was reaped before anyone waited for it, its pid (0 if there is none)
+  pid_t takeUnclaimedExit(pid_t group, int *status, struct rusage *usage);
+  // in a forked child that doesn't exec, the pidfds and the epoll set are the smash's (the jobs are signaled by pid)
+  void closeDescriptors();
   JobEntry *getLastJob(int *lastJobId);
   JobEntry *getLastStoppedJob(int *jobId);
 
+private:
+  /* types */
+  struct FinishedJob
+  {
+    unsigned int job_id;
+    std::string cmd_line;
+    int status;
+    double wall_seconds;
+    ResourceUsage usage;
+  };
+
+  // a child that the sweep of removeFinishedJobs reaped before it was added as a job (or waited for)
+  struct UnclaimedExit
+  {
+    pid_t group; // it can't be asked for once the child is reaped
+    int status;
+    struct rusage usage;
+  };
+
+  /* variables */
+  static const size_t MAX_FINISHED = 16;
+  // m_slots[id] is the job with that id (an empty slot has no command), so the ids are sorted by design.
+  // a new job gets the maximal id + 1, so there are never empty slots at the end.
+  std::vector<JobEntry> m_slots;
+  std::unordered_map<pid_t, unsigned int> m_ids_by_pid;
+  std::set<unsigned int> m_stopped_ids;
+  unsigned int m_count;
+  std::unordered_map<pid_t, int> m_kept_statuses; // -1 until the process is reaped
+  int m_exits; // epoll over the pidfds of the jobs (by pid), readable when any of them exits
+  std::deque<FinishedJob> m_finished; // the last ones, oldest first
+  std::unordered_map<pid_t, UnclaimedExit> m_unclaimed; // by pid, until addJob (or takeUnclaimedExit) claims them
+
+  /* methods */
+  bool _is_used(unsigned int jobId) const;
+  JobEntry *_find_job(pid_t pid); // by its pid, or by its process group (before it's reaped)
+  void _reap(pid_t pid); // a child that exited
+  void _update_job(JobEntry *job, pid_t pid, int status, const struct rusage *usage);
+  void _close_pidfd(JobEntry &job);
+  void _release(JobEntry &job, bool keep_command = false); // closes its pidfd, and deletes its command unless it's kept
+};
+
+/* *
+ * The CommandPlan class
+ * A script that was parsed ahead of time: every line is classified and tokenized once when the script is loaded,
+ * and all the syntax errors are reported before anything runs.
+ * The commands themselves are only created right before they run, since their validity depends on
+ * the state of the smash at that point (the jobs list, the working directory, ...).
+ */
+
+class CommandPlan
+{
+public:
+  /* types */
+  struct Step
+  {
+    unsigned int line_number; // in the script, starting from 1
+    std::string cmd_line;
+    CommandTokens tokens;
+    CommandFactory factory;
+
+    Step(unsigned int line_number, const std::string &cmd_line);
+  };
+
+  /* methods */
+  CommandPlan();
+  bool load(const std::string &path); // memory maps and parses the script, false on failure (errors already printed)
+  bool isUpToDate(const struct stat &file_status) const;
+  const std::vector<Step> &getSteps() const { return m_steps; }
+
+private:
+  /* variables */
+  std::vector<Step> m_steps;
+  struct stat m_file_status; // of the script when it was loaded
+
+  /* methods */
+  static bool _check_syntax(const char *cmd_line, std::string *error);
+};
+
+/* *
+ * The EventLoop class
+ * Reads the command lines of the smash from its standard input. While it waits for the next line (epoll),
+ * the children that changed their state are handled right away (finished jobs are reaped as they finish).
+ * The input is read in big chunks, but a regular file is left right after the returned line (like bash),
+ * so the commands that read the standard input get the rest of it.
+ */
+
+class EventLoop
+{
+public:
+  /* methods */
+  EventLoop();
+  ~EventLoop();
+  EventLoop(const EventLoop &) = delete;
+  void operator=(const EventLoop &) = delete;
+  bool nextLine(std::string *line); // false at the end of the input
+
 private:
   /* variables */
-  std::list<JobEntry> m_jobs;
+  int m_epoll;
+  bool m_input_polled;  // false for regular files, epoll doesn't take them (they are always readable)
+  bool m_input_seekable;
+  bool m_end_of_input;
+  std::string m_buffer; // read but not returned yet
+
+  /* methods */
+  void _wait_for_input();
+  void _read_input();
+};
+
+/* *
+ * The OutputBuffer class
+ */
+
+/**
+ * @brief The buffer of the standard output of the smash (installed into std::cout), written to fd 1 with write(2).
+ *    Nothing is written until it fills up or until one of the flush points (`std::cout.flush()`):
+ *    before a fork / spawn, before the prompt, and before fd 1 is redirected or restored.
+ */
+class OutputBuffer : public std::streambuf
+{
+public:
+  /* static variables */
+  static const std::size_t SIZE = 1 << 16;
+
+  /* methods */
+  OutputBuffer();
+  virtual ~OutputBuffer();
+
+protected:
+  int_type overflow(int_type c) override;
+  int sync() override;
+
+private:
+  /* variables */
+  char m_buffer[SIZE];
+
+  /* methods */
+  bool _write_buffer(); // false on failure, the buffer is emptied either way
 };
 
 /* *
@@ -357,22 +1183,51 @@ public:
   }
   ~SmallShell();
   void executeCommand(const char *cmd_line);
+  CommandFactory ClassifyCommand(const char *cmd_line, const CommandTokens &tokens) const; // nullptr for empty lines
+  bool runScript(const std::string &path); // false if the script could not be loaded
 
   JobsList &getJobsList();
+  CommandPathCache &getPathCache();
+  TimeoutScheduler &getTimeouts();
+  CommandHistory &getHistory();
+  // waits for a process that runs in the foreground, if it gets stopped it is added to the jobs list
+  // (with more than one process, pid is the process group of all of them)
+  void waitForeground(Command *cmd, pid_t pid, unsigned int jobId = 0, unsigned int processes = 1);
+  // in a forked child that runs code of the smash instead of an exec: the signals are not handled like in the smash,
+  // and its notifications and deadlines are not the child's
+  void enterChild();
+  ResourceUsage takeForegroundUsage(); // of the foreground processes that exited since the last time it was taken
+  void timeChild(pid_t pid);           // a child that runs a time command in place, since now
+  // once a child was reaped, by whoever reaped it: prints the time line if it was timed
+  void reportTimedChild(pid_t pid, const struct rusage &usage);
+  pid_t getForegroundPid() const { return m_currForegroundPID; }
+  pid_t getPid() const { return m_pid; }
   const std::string &getPrompt() const;
   void setPrompt(const std::string &newPrompt);
 
 private:
   /* variables */
   std::string m_prompt; // originally set to DEFAULT_PROMPT
+  OutputBuffer m_output;
+  std::streambuf *m_original_output; // of std::cout, restored on destruction
   JobsList m_background_jobs;
+  CommandPathCache m_path_cache;
+  TimeoutScheduler m_timeouts;
+  CommandHistory m_history;
 
-  int m_currForegroundPID;
+  volatile pid_t m_currForegroundPID; // read by the signal handlers, 0 when there is none
+  ResourceUsage m_foreground_usage;
+  std::unordered_map<pid_t, double> m_timed_children; // their start times, see timeChild
+  pid_t m_pid;
+  std::map<std::string, CommandPlan> m_scripts; // the cached plans by script path
+  std::set<std::string> m_running_scripts;      // to detect scripts that source themselves
 
   /* methods */
   SmallShell(); // private c'tor
 
   Command *CreateCommand_aux(const char *cmd_line);
+  Command *_create_command(CommandFactory factory, const char *cmd_line, const CommandTokens &tokens);
+  void _run_command(Command *cmd);
 };
 
 #endif // SMASH_COMMAND_H_
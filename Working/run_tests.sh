@@ -0,0 +1,120 @@
+#!/bin/bash
+# Runs the smash tests (test_input<N>.txt, compared to test_expected_output<N>.txt) all at the same time.
+# Every test runs in its own empty temporary directory, with its own HOME, and in its own session: the smash moves
+# its jobs to their own process groups, but they all stay in its session, so everything the test started is killed
+# when it's done (or when it runs out of time).
+#
+# usage: run_tests.sh [-t <timeout seconds>] [-j <parallel tests>] [-s <smash>] [test_input...]
+#   -t  per test, 60 by default
+#   -j  how many tests run at the same time, 0 (the default) for all of them
+#   -s  the smash to test, ./smash by default
+# The directory of a test that failed is kept (with its output, errors and diff), the others are removed.
+
+TIMEOUT=60
+JOBS=0
+SMASH=./smash
+while getopts "t:j:s:" option; do
+    case $option in
+        t) TIMEOUT=$OPTARG ;;
+        j) JOBS=$OPTARG ;;
+        s) SMASH=$OPTARG ;;
+        *) echo "usage: $0 [-t <timeout seconds>] [-j <parallel tests>] [-s <smash>] [test_input...]" >&2; exit 2 ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+INPUTS=("$@")
+if [ ${#INPUTS[@]} -eq 0 ]; then
+    INPUTS=(test_input*.txt)
+fi
+if [ ! -e "${INPUTS[0]}" ]; then
+    echo "$0: no tests to run" >&2
+    exit 2
+fi
+if [ ! -x "$SMASH" ]; then
+    echo "$0: $SMASH is not an executable" >&2
+    exit 2
+fi
+# the tests run in other directories
+SMASH=$(cd "$(dirname "$SMASH")" && pwd)/$(basename "$SMASH")
+
+RESULTS=$(mktemp -d "${TMPDIR:-/tmp}/smash_results.XXXXXX") || exit 2
+trap 'rm -rf "$RESULTS"' EXIT
+
+now_ns()
+{
+    date +%s%N
+}
+
+# writes "<result> <milliseconds> <directory>" to $RESULTS/<test>
+run_test()
+{
+    # runs in a subshell of its own, bash reports the killed smash on its stderr as a job notice
+    exec 3>&2 2> /dev/null
+    local input=$1
+    local name
+    name=$(basename "$input" .txt)
+    local expected
+    expected="$(dirname "$input")/test_expected_output${name#test_input}.txt"
+    local sandbox
+    sandbox=$(mktemp -d "${TMPDIR:-/tmp}/smash_$name.XXXXXX" 2>&3) || return
+
+    local start
+    start=$(now_ns)
+    local deadline=$((start + TIMEOUT * 1000000000))
+    # setsid makes the smash the leader of a new session (it's not a group leader, so setsid doesn't fork)
+    (cd "$sandbox" && HOME=$sandbox exec setsid "$SMASH") < "$input" > "$sandbox/output.txt" 2> "$sandbox/errors.txt" &
+    local session=$!
+    local result=PASS
+    while kill -0 "$session"; do
+        if [ "$(now_ns)" -gt "$deadline" ]; then
+            result=TIMEOUT
+            break
+        fi
+        sleep 0.05
+    done
+    # the smash itself if it timed out, and whatever it left behind
+    pkill -KILL -s "$session"
+    wait "$session"
+    local elapsed=$((($(now_ns) - start) / 1000000))
+
+    if [ $result = PASS ] && ! diff "$expected" "$sandbox/output.txt" > "$sandbox/diff.txt" 2>&1; then
+        result=FAIL
+    fi
+    if [ $result = PASS ]; then
+        rm -rf "$sandbox"
+    fi
+    echo "$result $elapsed $sandbox" > "$RESULTS/$name"
+}
+
+unset SMASH_HISTORY
+START=$(now_ns)
+for input in "${INPUTS[@]}"; do
+    while [ "$JOBS" -gt 0 ] && [ "$(jobs -rp | wc -l)" -ge "$JOBS" ]; do
+        wait -n
+    done
+    run_test "$input" &
+done
+wait
+
+FAILED=0
+for input in "${INPUTS[@]}"; do
+    name=$(basename "$input" .txt)
+    if ! read -r result elapsed sandbox < "$RESULTS/$name"; then
+        result=ERROR elapsed=0 sandbox="(no directory)"
+    fi
+    printf "%-8s %8d ms  %s\n" "$result" "$elapsed" "$input"
+    if [ "$result" != PASS ]; then
+        FAILED=$((FAILED + 1))
+        echo "    kept in $sandbox"
+        if [ "$result" = FAIL ]; then
+            sed 's/^/    /' "$sandbox/diff.txt"
+        fi
+        if [ -s "$sandbox/errors.txt" ]; then
+            echo "    stderr:"
+            sed 's/^/    /' "$sandbox/errors.txt"
+        fi
+    fi
+done
+echo "${#INPUTS[@]} tests, $FAILED failed, $((($(now_ns) - START) / 1000000)) ms"
+[ $FAILED -eq 0 ]
@@ -1,11 +1,202 @@
 #include <iostream>
 #include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
 #include "signals.h"
 #include "Commands.h"
 
 using namespace std;
 
-void ctrlCHandler(int sig_num) {
-  // TODO: Add your implementation
+/* ctrl-C and ctrl-Z, for whoever waits without a foreground process */
+static volatile sig_atomic_t terminal_signal = 0;
+
+/* *
+ * The handlers may interrupt the smash anywhere, even inside std::cout, so they write their messages with write(2)
+ * only (async-signal-safe), from buffers on their own stack.
+ */
+static void write_message(const char *first, const char *second = "", const char *third = "")
+{
+  const char *parts[] = {first, second, third};
+  for (const char *part : parts)
+  {
+    size_t length = strlen(part);
+    while (length > 0)
+    {
+      ssize_t written = write(STDOUT_FILENO, part, length);
+      if (written <= 0)
+      {
+        return; // nothing to report it to
+      }
+      part += written;
+      length -= written;
+    }
+  }
+}
+
+// the digits of pid, at the end of buffer
+static const char *format_pid(pid_t pid, char *buffer, size_t size)
+{
+  char *digits = buffer + size - 1;
+  *digits = '\0';
+  do
+  {
+    *--digits = static_cast<char>('0' + pid % 10);
+    pid /= 10;
+  } while (pid > 0 && digits > buffer);
+  return digits;
+}
+
+// sends the signal to the foreground process group, and tells what happened to it (done, as in "was killed")
+static void forward(int sig_num, const char *done)
+{
+  // the foreground process is in its own process group, so the terminal sent the signal to smash only
+  pid_t pid = SmallShell::getInstance().getForegroundPid();
+  if (pid <= 0)
+  {
+    return;
+  }
+  if (kill(-pid, sig_num) == -1)
+  {
+    // perror is not async-signal-safe, these are the only errors kill can fail with here
+    write_message("smash error: kill failed: ", (errno == EPERM) ? "Operation not permitted\n" : "No such process\n");
+  }
+  else
+  {
+    char buffer[32];
+    write_message("smash: process ", format_pid(pid, buffer, sizeof(buffer)), done);
+  }
 }
 
+void ctrlCHandler(int sig_num)
+{
+  (void)sig_num; // every handler is set for its own signal only
+  int saved_errno = errno; // the handler may interrupt code that checks errno
+  terminal_signal = SIGINT;
+  write_message("smash: got ctrl-C\n");
+  // the foreground wait returns once the process is gone
+  forward(SIGKILL, " was killed\n");
+  errno = saved_errno;
+}
+
+void ctrlZHandler(int sig_num)
+{
+  (void)sig_num;
+  int saved_errno = errno;
+  terminal_signal = SIGTSTP;
+  write_message("smash: got ctrl-Z\n");
+  // the foreground wait returns and adds it to the jobs list as a stopped job
+  forward(SIGSTOP, " was stopped\n");
+  errno = saved_errno;
+}
+
+/* the notifications of the SIGCHLD and SIGALRM handlers: a flag, and a self-pipe so they can also be polled */
+struct Notifications
+{
+  volatile sig_atomic_t pending;
+  int pipe[2]; // read end first
+};
+static Notifications child_notifications = {0, {-1, -1}};
+static Notifications alarm_notifications = {0, {-1, -1}};
+
+static void notify(Notifications &notifications)
+{
+  int saved_errno = errno; // the handler may interrupt code that checks errno
+  notifications.pending = 1;
+  // if the pipe is full there are unread notifications anyway, so a failed write is fine
+  ssize_t written = write(notifications.pipe[1], "n", 1);
+  (void)written;
+  errno = saved_errno;
+}
+
+static bool setup(Notifications &notifications)
+{
+  notifications.pending = 0;
+  return pipe2(notifications.pipe, O_NONBLOCK | O_CLOEXEC) == 0;
+}
+
+static bool take(Notifications &notifications)
+{
+  if (!notifications.pending) // no syscalls at all if nothing happened
+  {
+    return false;
+  }
+  // cleared before the caller handles them, so what happens later is noticed next time
+  notifications.pending = 0;
+  char buffer[64];
+  while (read(notifications.pipe[0], buffer, sizeof(buffer)) > 0)
+  {
+  }
+  return true;
+}
+
+static bool renew(Notifications &notifications)
+{
+  for (int &fd : notifications.pipe)
+  {
+    if (fd != -1)
+    {
+      close(fd);
+      fd = -1;
+    }
+  }
+  return setup(notifications);
+}
+
+void alarmHandler(int sig_num)
+{
+  (void)sig_num;
+  // the deadlines are expired outside of the handler (see TimeoutScheduler::poll)
+  notify(alarm_notifications);
+}
+
+void childHandler(int sig_num)
+{
+  (void)sig_num;
+  notify(child_notifications);
+}
+
+bool setupChildNotifications()
+{
+  return setup(child_notifications);
+}
+
+bool takeChildNotifications()
+{
+  return take(child_notifications);
+}
+
+int getChildNotificationsFd()
+{
+  return child_notifications.pipe[0];
+}
+
+bool setupAlarmNotifications()
+{
+  return setup(alarm_notifications);
+}
+
+bool takeAlarmNotifications()
+{
+  return take(alarm_notifications);
+}
+
+int getAlarmNotificationsFd()
+{
+  return alarm_notifications.pipe[0];
+}
+
+bool renewNotifications()
+{
+  // the smash reads its own copies of the pipes, a child that writes to them would wake it up for nothing
+  bool renewed = (child_notifications.pipe[0] == -1 || renew(child_notifications));
+  return (alarm_notifications.pipe[0] == -1 || renew(alarm_notifications)) && renewed;
+}
+
+int takeTerminalSignal()
+{
+  int taken = terminal_signal;
+  terminal_signal = 0;
+  return taken;
+}
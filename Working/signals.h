@@ -2,6 +2,32 @@
 #define SMASH__SIGNALS_H_
 
 void ctrlCHandler(int sig_num);
+void ctrlZHandler(int sig_num);
 void alarmHandler(int sig_num);
+void childHandler(int sig_num);
+
+/**
+ * The SIGCHLD handler only takes note that some child changed its state (and writes to a self-pipe,
+ * so it can also be polled), the children are reaped later outside of the handler.
+ */
+bool setupChildNotifications();  // creates the self-pipe, must be called before childHandler is set
+bool takeChildNotifications();   // true if some child changed its state since the last call
+int getChildNotificationsFd();   // readable when some child changed its state
+
+/**
+ * The same for SIGALRM, the deadlines of the timed commands are expired later outside of the handler.
+ */
+bool setupAlarmNotifications();  // creates the self-pipe, must be called before alarmHandler is set
+bool takeAlarmNotifications();   // true if SIGALRM arrived since the last call
+int getAlarmNotificationsFd();   // readable when SIGALRM arrived
+
+// in a forked child that runs code of the smash, new self-pipes that are not shared with the smash
+bool renewNotifications();
+
+/**
+ * ctrl-C and ctrl-Z are also noted, for the built in commands that wait for children that are not the foreground
+ * process (see ParallelCommand).
+ */
+int takeTerminalSignal(); // SIGINT or SIGTSTP if one of them arrived since the last call (the last one), otherwise 0
 
 #endif //SMASH__SIGNALS_H_
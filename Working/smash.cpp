@@ -4,6 +4,7 @@
 #include <signal.h>
 #include "Commands.h"
 #include "signals.h"
+#include "trace.h"
 
 int main(int argc, char *argv[])
 {
@@ -11,34 +12,107 @@ int main(int argc, char *argv[])
      * change the signal handler for when the user clicks Ctrl+C
      * to use the function ctrlCHandler defined in signals.h
      */
-    if (signal(SIGINT, ctrlCHandler) == SIG_ERR)
+    struct sigaction interrupt_action = {};
+    interrupt_action.sa_handler = ctrlCHandler;
+    interrupt_action.sa_flags = SA_RESTART;
+    if (sigaction(SIGINT, &interrupt_action, nullptr) == -1)
     {
         perror("smash error: failed to set ctrl-C handler");
     }
 
-    // TODO: setup sig alarm handler (bonus)
+    // Ctrl+Z stops the process running in the foreground (and moves it to the jobs list)
+    struct sigaction stop_action = {};
+    stop_action.sa_handler = ctrlZHandler;
+    stop_action.sa_flags = SA_RESTART;
+    if (sigaction(SIGTSTP, &stop_action, nullptr) == -1)
+    {
+        perror("smash error: failed to set ctrl-Z handler");
+    }
+
+    /**
+     * finished jobs are reaped only after a SIGCHLD says some child changed its state.
+     * SA_RESTART so the blocking reads and waits of the smash are not interrupted by it.
+     */
+    struct sigaction child_action = {};
+    child_action.sa_handler = childHandler;
+    child_action.sa_flags = SA_RESTART;
+    if (!setupChildNotifications() || sigaction(SIGCHLD, &child_action, nullptr) == -1)
+    {
+        perror("smash error: failed to set child handler");
+    }
+
     /**
      * change the signal handler for when the process gets a SIG_ALRM signal
-     * from the OS, after using the alarm() system call.
+     * from the OS, after using the alarm() system call (by the `timeout` command).
      * here we set the handler to the alarmHandler function defined in signals.h
      */
-    if (sigaction(SIGALRM) == SIG_ERR)
+    struct sigaction alarm_action = {};
+    alarm_action.sa_handler = alarmHandler;
+    alarm_action.sa_flags = SA_RESTART;
+    if (!setupAlarmNotifications() || sigaction(SIGALRM, &alarm_action, nullptr) == -1)
     {
         perror("smash error: failed to set alarm handler");
     }
-    
 
     // get the smash singleton instance locally
     SmallShell &smash = SmallShell::getInstance();
-    // run an infinite loop for reading the next command for execution
+
+    // `smash --trace <file>` traces the phases of every line from the start (see Tracer),
+    // `smash -f <script>` runs the script (parsed ahead of time) instead of reading commands from the terminal
+    const char *script = nullptr;
+    for (int i = 1; i < argc; i += 2)
+    {
+        std::string option(argv[i]);
+        if (i + 1 < argc && option == "--trace")
+        {
+            if (!Tracer::getInstance().start(argv[i + 1]))
+            {
+                return 1;
+            }
+        }
+        else if (i + 1 < argc && option == "-f")
+        {
+            script = argv[i + 1];
+        }
+        else
+        {
+            std::cerr << "usage: smash [--trace <file>] [-f <script>]\n";
+            return 1;
+        }
+    }
+    if (script)
+    {
+        return smash.runScript(script) ? 0 : 1;
+    }
+
+    // the history is kept on disk for the terminal (or wherever SMASH_HISTORY points), otherwise for the session only
+    const char *history_path = getenv("SMASH_HISTORY");
+    const char *home = getenv("HOME");
+    if (history_path)
+    {
+        smash.getHistory().open(history_path);
+    }
+    else if (home && isatty(STDIN_FILENO))
+    {
+        smash.getHistory().open(std::string(home) + "/.smash_history");
+    }
+
+    // run a loop for reading the next command for execution, until the end of the input
+    EventLoop events;
+    std::string cmd_line;
     while (true)
     {
         // get the current prompt for the smash
         std::cout << smash.getPrompt() << "> ";
-        // take in the command from the terminal
-        std::string cmd_line;
-        std::getline(std::cin, cmd_line);
-        // execute the command
+        // the output of the smash is buffered, everything up to the prompt is written here
+        std::cout.flush();
+        // take in the command from the terminal (the finished jobs are handled while waiting for it)
+        if (!events.nextLine(&cmd_line))
+        {
+            break;
+        }
+        // execute the command (it's in the history by then, like in bash)
+        smash.getHistory().add(cmd_line);
         smash.executeCommand(cmd_line.c_str());
     }
     return 0;
@@ -0,0 +1,222 @@
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <string>
+#include <vector>
+#include "Commands.h"
+
+/**
+ * Microbenchmarks for the smash hot paths, linked against the same smash_core library as the smash itself.
+ * usage: smash_bench [--json <file>] [iterations] [spawns]
+ * With --json the results are also written as JSON, so runs of different builds can be compared.
+ */
+
+typedef std::chrono::steady_clock Clock;
+
+struct Result
+{
+    std::string name;
+    unsigned long iterations;
+    double seconds;
+};
+
+static std::vector<Result> RESULTS;
+
+// keeps the results of the benchmarked calls alive, so they are not optimized away
+static volatile unsigned long SINK;
+
+static double seconds_since(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static void report(const std::string &name, unsigned long iterations, double seconds)
+{
+    std::cout << name << ": " << iterations << " ops in " << seconds << "s ("
+              << static_cast<unsigned long>(seconds * 1e9 / iterations) << " ns/op)\n";
+    Result result = {name, iterations, seconds};
+    RESULTS.push_back(result);
+}
+
+static bool write_json(const char *path)
+{
+    std::ofstream json(path);
+    json << "{\n  \"benchmark\": \"smash_bench\",\n  \"timestamp\": " << time(nullptr) << ",\n  \"results\": [";
+    for (size_t i = 0; i < RESULTS.size(); ++i)
+    {
+        const Result &result = RESULTS[i];
+        json << ((i == 0) ? "" : ",") << "\n    {\"name\": \"" << result.name << "\", \"iterations\": " << result.iterations
+             << ", \"seconds\": " << result.seconds << ", \"ns_per_op\": " << result.seconds * 1e9 / result.iterations << "}";
+    }
+    json << "\n  ]\n}\n";
+    json.close();
+    if (!json)
+    {
+        std::cerr << "smash_bench: failed to write " << path << "\n";
+        return false;
+    }
+    return true;
+}
+
+// the single pass tokenizer that every line goes through
+static void bench_tokenize(unsigned long iterations)
+{
+    const char *line = "ls -l --color=never /tmp/some/directory other/file.txt &";
+    Clock::time_point start = Clock::now();
+    for (unsigned long i = 0; i < iterations; ++i)
+    {
+        CommandTokens tokens(line);
+        SINK = SINK + tokens.size();
+    }
+    report("CommandTokens", iterations, seconds_since(start));
+}
+
+static void bench_trim(unsigned long iterations)
+{
+    std::string line = "    sleep 100 > /tmp/out.txt &    ";
+    Clock::time_point start = Clock::now();
+    for (unsigned long i = 0; i < iterations; ++i)
+    {
+        SINK = SINK + _trim(line).size();
+    }
+    report("_trim", iterations, seconds_since(start));
+}
+
+// classification and construction only, the commands are not executed (a fork would dominate)
+static void bench_create(const char *name, const char *cmd_line, unsigned long iterations)
+{
+    SmallShell &smash = SmallShell::getInstance();
+    Clock::time_point start = Clock::now();
+    for (unsigned long i = 0; i < iterations; ++i)
+    {
+        delete smash.CreateCommand(cmd_line);
+    }
+    report(name, iterations, seconds_since(start));
+}
+
+// lines that go all the way through executeCommand without printing or forking
+static void bench_execute_built_in(unsigned long iterations)
+{
+    SmallShell &smash = SmallShell::getInstance();
+    Clock::time_point start = Clock::now();
+    for (unsigned long i = 0; i < iterations; ++i)
+    {
+        smash.executeCommand("chprompt bench");
+    }
+    report("executeCommand(chprompt)", iterations, seconds_since(start));
+    smash.setPrompt(SmallShell::DEFAULT_PROMPT);
+}
+
+// the jobs list operations with the given number of jobs in it.
+// the pids are above any possible pid (see pid_max in proc(5)), so the jobs don't refer to real processes
+static void bench_jobs_list(unsigned long jobs_count)
+{
+    const pid_t FIRST_PID = 1 << 30;
+    SmallShell &smash = SmallShell::getInstance();
+    std::vector<Command *> commands;
+    for (unsigned long i = 0; i < jobs_count; ++i)
+    {
+        commands.push_back(smash.CreateCommand("sleep 100&"));
+    }
+    std::string size = "[" + std::to_string(jobs_count) + " jobs]";
+    JobsList jobs;
+
+    Clock::time_point start = Clock::now();
+    for (unsigned long i = 0; i < jobs_count; ++i)
+    {
+        jobs.addJob(commands[i], FIRST_PID + i); // owned by the list from here on
+    }
+    report("JobsList::addJob " + size, jobs_count, seconds_since(start));
+
+    start = Clock::now();
+    for (unsigned long i = 1; i <= jobs_count; ++i)
+    {
+        SINK = SINK + (jobs.getJobById(i) != nullptr);
+    }
+    report("JobsList::getJobById " + size, jobs_count, seconds_since(start));
+
+    start = Clock::now();
+    for (unsigned long i = 0; i < jobs_count; ++i)
+    {
+        SINK = SINK + (jobs.getJobByPid(FIRST_PID + i) != nullptr);
+    }
+    report("JobsList::getJobByPid " + size, jobs_count, seconds_since(start));
+
+    start = Clock::now();
+    for (unsigned long i = 0; i < jobs_count; ++i)
+    {
+        int id;
+        SINK = SINK + (jobs.getLastJob(&id) != nullptr);
+    }
+    report("JobsList::getLastJob " + size, jobs_count, seconds_since(start));
+
+    start = Clock::now();
+    for (unsigned long i = 0; i < jobs_count; ++i)
+    {
+        jobs.removeFinishedJobs(); // nothing to reap, the common case on every line
+    }
+    report("JobsList::removeFinishedJobs " + size, jobs_count, seconds_since(start));
+
+    start = Clock::now();
+    for (unsigned long i = 1; i <= jobs_count; ++i)
+    {
+        jobs.removeJobById(i);
+    }
+    report("JobsList::removeJobById " + size, jobs_count, seconds_since(start));
+}
+
+// spawn-to-reap of a foreground external command, with the given launch engine
+static void bench_spawn(const char *name, ExternalCommand::LaunchEngine engine, unsigned long iterations)
+{
+    SmallShell &smash = SmallShell::getInstance();
+    ExternalCommand::LaunchEngine original_engine = ExternalCommand::LAUNCH_ENGINE;
+    ExternalCommand::LAUNCH_ENGINE = engine;
+    Clock::time_point start = Clock::now();
+    for (unsigned long i = 0; i < iterations; ++i)
+    {
+        smash.executeCommand("/bin/true");
+    }
+    report(name, iterations, seconds_since(start));
+    ExternalCommand::LAUNCH_ENGINE = original_engine;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *json_path = nullptr;
+    int arg = 1;
+    if (arg + 1 < argc && std::string(argv[arg]) == "--json")
+    {
+        json_path = argv[arg + 1];
+        arg += 2;
+    }
+    unsigned long iterations = (argc > arg) ? std::strtoul(argv[arg], nullptr, 10) : 100000;
+    unsigned long spawns = (argc > arg + 1) ? std::strtoul(argv[arg + 1], nullptr, 10) : 1000;
+    if (iterations == 0 || spawns == 0)
+    {
+        std::cerr << "usage: smash_bench [--json <file>] [iterations] [spawns]\n";
+        return 1;
+    }
+
+    // the smash installs its own buffer into std::cout, before anything is printed
+    SmallShell::getInstance();
+
+    bench_tokenize(iterations);
+    bench_trim(iterations);
+    bench_create("CreateCommand(built in)", "chprompt bench", iterations);
+    bench_create("CreateCommand(external)", "ls -l /tmp", iterations);
+    bench_create("CreateCommand(redirection)", "ls -l /tmp > /dev/null", iterations);
+    bench_create("CreateCommand(pipe)", "ls -l /tmp | wc -l", iterations);
+    bench_execute_built_in(iterations);
+    const unsigned long JOBS_COUNTS[] = {10, 1000, 100000};
+    for (unsigned long jobs_count : JOBS_COUNTS)
+    {
+        bench_jobs_list(jobs_count);
+    }
+    bench_spawn("executeCommand(/bin/true) [fork]", ExternalCommand::LaunchEngine::Fork, spawns);
+    bench_spawn("executeCommand(/bin/true) [posix_spawn]", ExternalCommand::LaunchEngine::Spawn, spawns);
+
+    std::cout.flush();
+    return (json_path && !write_json(json_path)) ? 1 : 0;
+}
@@ -0,0 +1,140 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "trace.h"
+
+/* static variables */
+bool Tracer::ENABLED = false;
+
+Tracer::Tracer()
+    : m_events(),
+      m_next(0),
+      m_count(0),
+      m_path(),
+      m_pid(getpid())
+{
+}
+
+Tracer::~Tracer()
+{
+  // the smash is exiting (quit, or the end of its input), whatever was traced is not lost.
+  // the forked children that exit (pipeline stages, ...) have a copy of the buffer, and must not write it
+  if (ENABLED && getpid() == m_pid)
+  {
+    stop();
+  }
+}
+
+unsigned long long Tracer::now()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+bool Tracer::start(const std::string &path)
+{
+  // the file is created right away, so a bad path is reported now and not when the trace is written
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd == -1)
+  {
+    perror("smash error: open failed");
+    return false;
+  }
+  close(fd);
+
+  m_path = path;
+  m_events.resize(CAPACITY);
+  m_next = 0;
+  m_count = 0;
+  m_pid = getpid();
+  ENABLED = true;
+  return true;
+}
+
+bool Tracer::stop()
+{
+  ENABLED = false;
+  bool written = _write();
+  // the buffer is only needed while tracing
+  std::vector<Event>().swap(m_events);
+  m_next = 0;
+  m_count = 0;
+  return written;
+}
+
+void Tracer::record(const char *name, unsigned long long start, unsigned long long end, const char *detail)
+{
+  if (!ENABLED) // turned off inside the scope
+  {
+    return;
+  }
+  Event &event = m_events[m_next];
+  event.name = name;
+  event.start = start;
+  event.duration = end - start;
+  event.detail[0] = '\0';
+  if (detail)
+  {
+    strncpy(event.detail, detail, DETAIL_LENGTH - 1);
+    event.detail[DETAIL_LENGTH - 1] = '\0';
+  }
+  m_next = (m_next + 1) % CAPACITY;
+  if (m_count < CAPACITY)
+  {
+    ++m_count;
+  }
+}
+
+bool Tracer::_write() const
+{
+  FILE *file = fopen(m_path.c_str(), "we");
+  if (file == nullptr)
+  {
+    perror("smash error: fopen failed");
+    return false;
+  }
+
+  // https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU, complete ("X") events in us
+  fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+  size_t first = (m_count < CAPACITY) ? 0 : m_next; // the oldest event
+  for (size_t i = 0; i < m_count; ++i)
+  {
+    const Event &event = m_events[(first + i) % CAPACITY];
+    fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%llu.%03llu,\"dur\":%llu.%03llu,\"pid\":%d,\"tid\":%d",
+            (i == 0) ? "" : ",", event.name, event.start / 1000, event.start % 1000,
+            event.duration / 1000, event.duration % 1000, m_pid, m_pid);
+    if (event.detail[0] != '\0')
+    {
+      fprintf(file, ",\"args\":{\"line\":\"");
+      for (const char *c = event.detail; *c; ++c)
+      {
+        if (*c == '"' || *c == '\\')
+        {
+          fprintf(file, "\\%c", *c);
+        }
+        else if (static_cast<unsigned char>(*c) < 0x20)
+        {
+          fprintf(file, "\\u%04x", *c);
+        }
+        else
+        {
+          fputc(*c, file);
+        }
+      }
+      fprintf(file, "\"}");
+    }
+    fprintf(file, "}");
+  }
+  fprintf(file, "\n]}\n");
+
+  if (fclose(file) == EOF)
+  {
+    perror("smash error: fclose failed");
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,99 @@
+#ifndef SMASH_TRACE_H_
+#define SMASH_TRACE_H_
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+/* *
+ * The Tracer class
+ * Records where the smash spends its time on every line: each phase (read, tokenize, dispatch, fork / spawn, wait,
+ * redirection setup / teardown, reap, ...) is a complete event with CLOCK_MONOTONIC timestamps, kept in a fixed
+ * ring buffer (the oldest events are overwritten, nothing is allocated while tracing).
+ * The events are written as a Chrome trace (for chrome://tracing or ui.perfetto.dev) when tracing is stopped,
+ * or when the smash exits.
+ * When tracing is off, a TraceScope costs a single test of Tracer::ENABLED.
+ */
+class Tracer
+{
+public:
+  /* static variables */
+  static bool ENABLED;
+
+  /* methods */
+  static Tracer &getInstance()
+  {
+    static Tracer instance;
+    return instance;
+  }
+  ~Tracer();
+  Tracer(const Tracer &) = delete;
+  void operator=(const Tracer &) = delete;
+
+  bool start(const std::string &path); // false if the trace file can't be written (already reported)
+  bool stop();                         // writes the trace file, false on failure (already reported)
+  const std::string &getPath() const { return m_path; }
+  size_t size() const { return m_count; }
+  // detail (may be nullptr) is copied, and cut at DETAIL_LENGTH
+  void record(const char *name, unsigned long long start, unsigned long long end, const char *detail = nullptr);
+  static unsigned long long now(); // in nanoseconds
+
+private:
+  /* types */
+  static const size_t DETAIL_LENGTH = 64;
+  struct Event
+  {
+    const char *name; // a string literal
+    unsigned long long start;
+    unsigned long long duration;
+    char detail[DETAIL_LENGTH];
+  };
+
+  /* variables */
+  static const size_t CAPACITY = 1 << 15;
+  std::vector<Event> m_events; // allocated when tracing starts
+  size_t m_next;               // where the next event goes
+  size_t m_count;              // at most CAPACITY
+  std::string m_path;
+  pid_t m_pid;
+
+  /* methods */
+  Tracer();
+  bool _write() const;
+};
+
+/* *
+ * Records the time from its construction until it's destroyed (or ended) as an event named name.
+ * The name must be a string literal, and the detail (if any) must outlive the scope.
+ */
+class TraceScope
+{
+public:
+  explicit TraceScope(const char *name, const char *detail = nullptr)
+      : m_name(name),
+        m_detail(detail),
+        m_start(Tracer::ENABLED ? Tracer::now() : 0)
+  {
+  }
+  ~TraceScope() { end(); }
+  void end()
+  {
+    if (m_start != 0)
+    {
+      Tracer::getInstance().record(m_name, m_start, Tracer::now(), m_detail);
+      m_start = 0;
+    }
+  }
+
+private:
+  /* variables */
+  const char *m_name;
+  const char *m_detail;
+  unsigned long long m_start; // 0 if tracing was off when the scope started
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(...) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(__VA_ARGS__)
+
+#endif // SMASH_TRACE_H_